@@ -17,17 +17,39 @@
 #include <android/log.h>
 #include <android_native_app_glue.h>
 #include "VulkanMain.hpp"
+#include "RenderThread.h"
+
+// Renders on its own thread, this thread only forwards events to it
+static RenderThread *renderThread = nullptr;
+
+static void post_message(RenderMessageType type) {
+  render_message msg = {};
+  msg.type = type;
+  renderThread->post(msg);
+}
 
 // Process the next main command.
 void handle_cmd(android_app* app, int32_t cmd) {
+  render_message msg = {};
   switch (cmd) {
     case APP_CMD_INIT_WINDOW:
       // The window is being shown, get it ready.
-      InitVulkan(app);
+      msg.type = RENDER_MSG_WINDOW_INIT;
+      msg.window = app->window;
+      renderThread->post(msg);
       break;
     case APP_CMD_TERM_WINDOW:
-      // The window is being hidden or closed, clean it up.
-      DeleteVulkan();
+      // The window is being hidden or closed, release the surface only.
+      // The device is kept so that coming back does not pay a cold start.
+      // The window is destroyed once we return, so wait for the render
+      // thread to stop using it.
+      msg.type = RENDER_MSG_WINDOW_TERM;
+      renderThread->postAndWait(msg);
+      break;
+    case APP_CMD_WINDOW_RESIZED:
+    case APP_CMD_CONFIG_CHANGED:
+      // Size or orientation changed, only the swapchain has to be rebuilt.
+      post_message(RENDER_MSG_WINDOW_RESIZED);
       break;
     default:
       __android_log_print(ANDROID_LOG_INFO, "Vulkan Tutorials",
@@ -46,11 +68,10 @@ static int32_t handle_input(struct android_app* app, AInputEvent* event)
 {
   if (AInputEvent_getType(event) == AINPUT_EVENT_TYPE_MOTION) {
     /* 画面のタップ操作の場合 */
-    __android_log_print (ANDROID_LOG_INFO, LOG_TAG,
-                         "Motion event: action=%d flag=%d metaState=0x%x",
-                         AMotionEvent_getAction(event),
-                         AMotionEvent_getFlags(event),
-                         AMotionEvent_getMetaState(event));
+    /*
+     * MOVE は 1 フレームに何度も届くのでログを出さない。
+     * 描画はフレームの先頭で 1 回だけ反映する。
+     */
     int32_t eventAction = AMotionEvent_getAction(event);
     if (eventAction == AMOTION_EVENT_ACTION_DOWN) {
       /* タップ操作が画面に触れた状態の場合 */
@@ -78,17 +99,17 @@ static int32_t handle_input(struct android_app* app, AInputEvent* event)
       /* タップ位置の取得 */
       float x = AMotionEvent_getX(event, 0); /* X座標 */
       float y = AMotionEvent_getY(event, 0); /* Y座標 */
-      __android_log_print (ANDROID_LOG_INFO, LOG_TAG,
-                           "move = (%f, %f) [%f]",
-                           x, y, x - xpos);
       /*
        * タッチ操作を回転に置き換える
        * 横方向の移動量を Y 軸の回転量に変換
        */
       //float yrot = 360.0f / engine->width * (x - xpos);
-      VulkanOnDrag(x - xpos, y - ypos);
-      /* 画面を描画するフラグを ON */
-      //needToDraw = 1;
+      /* 描画スレッドに送り、GPU への反映は次のフレームで行う */
+      render_message msg = {};
+      msg.type = RENDER_MSG_DRAG;
+      msg.x = x - xpos;
+      msg.y = y - ypos;
+      renderThread->post(msg);
     }
     return 1;
   } else if (AInputEvent_getType(event) == AINPUT_EVENT_TYPE_KEY) {
@@ -98,6 +119,27 @@ static int32_t handle_input(struct android_app* app, AInputEvent* event)
                          AKeyEvent_getAction(event),
                          AKeyEvent_getKeyCode(event),
                          AKeyEvent_getMetaState(event));
+    if (AKeyEvent_getAction(event) == AKEY_EVENT_ACTION_UP) {
+      /* 1, 2, 3 キーでスワップチェーンのポリシーを切り替える */
+      render_message msg = {};
+      msg.type = RENDER_MSG_SWAPCHAIN_POLICY;
+      switch (AKeyEvent_getKeyCode(event)) {
+        case AKEYCODE_1:
+          msg.value = SWAPCHAIN_POLICY_LOWEST_LATENCY;
+          renderThread->post(msg);
+          return 1;
+        case AKEYCODE_2:
+          msg.value = SWAPCHAIN_POLICY_POWER_SAVER;
+          renderThread->post(msg);
+          return 1;
+        case AKEYCODE_3:
+          msg.value = SWAPCHAIN_POLICY_MAX_THROUGHPUT;
+          renderThread->post(msg);
+          return 1;
+        default:
+          break;
+      }
+    }
   }
 
   return 0;
@@ -115,16 +157,19 @@ void android_main(struct android_app* app) {
   int events;
   android_poll_source* source;
 
-  // Main loop
+  renderThread = new RenderThread(app);
+  renderThread->start();
+
+  // Main loop: rendering is done by the render thread, so this thread only
+  // sleeps in the looper and dispatches events
   do {
-    if (ALooper_pollAll(IsVulkanReady() ? 1 : 0, nullptr,
-                        &events, (void**)&source) >= 0) {
+    if (ALooper_pollAll(-1, nullptr, &events, (void**)&source) >= 0) {
       if (source != NULL) source->process(app, source);
     }
-
-    // render if vulkan is ready
-    if (IsVulkanReady()) {
-      VulkanDrawFrame();
-    }
   } while (app->destroyRequested == 0);
+
+  // Deletes the device on the render thread and joins it
+  renderThread->stop();
+  delete renderThread;
+  renderThread = nullptr;
 }
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+#include <cstdio>
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+#include "FrameStats.h"
+
+static const char* kTAG = "FrameStats";
+#ifdef __ANDROID__
+#define LOGI(...) \
+  ((void)__android_log_print(ANDROID_LOG_INFO, kTAG, __VA_ARGS__))
+#else
+#define LOGI(...) \
+  ((void)(printf("%s: ", kTAG), printf(__VA_ARGS__), putchar('\n')))
+#endif
+
+/* Interval of the log summaries, in milliseconds */
+#define REPORT_INTERVAL 5000.0
+
+/* Exact buckets below this many microseconds, also the buckets per octave */
+#define SUB_BUCKETS 16
+#define MAX_MICROSECONDS ((1u << 22) - 1)
+
+/* A slot is recycled once per second, a second copy is never torn again */
+#define SLOT_READ_ATTEMPTS 2
+
+static const uint64_t kSlotUnused = UINT64_MAX;
+
+static const char *kStatNames[FRAME_STAT_NUM] = {
+        "cpu frame", "acquire", "submit", "fence wait", "present",
+};
+
+static double getTimeMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// Values below SUB_BUCKETS get a bucket each, above that every power of
+// two is split into SUB_BUCKETS buckets
+static uint32_t bucketOf(uint32_t us) {
+    if (us < SUB_BUCKETS) {
+        return us;
+    }
+    uint32_t msb = 31 - __builtin_clz(us);
+    uint32_t shift = msb - 4;
+    return (shift + 1) * SUB_BUCKETS + (us >> shift) - SUB_BUCKETS;
+}
+
+// Middle of the bucket, in milliseconds
+static float bucketValue(uint32_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket / 1000.0f;
+    }
+    uint32_t shift = bucket / SUB_BUCKETS - 1;
+    uint32_t low = (bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    return (low + ((1u << shift) - 1) / 2.0f) / 1000.0f;
+}
+
+FrameStats::FrameStats() : lastReport(0.0) {
+    for (uint32_t i = 0; i < FRAME_STATS_SLOTS; i++) {
+        resetSlot(slots[i], kSlotUnused);
+    }
+}
+
+void FrameStats::resetSlot(Slot &slot, uint64_t epoch) {
+    // Readers skip the slot while it is cleared, and the fence keeps the
+    // clearing from being seen before the marker
+    slot.epoch.store(kSlotUnused, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint32_t type = 0; type < FRAME_STAT_NUM; type++) {
+        for (uint32_t i = 0; i < FRAME_STATS_BUCKETS; i++) {
+            slot.counts[type][i].store(0, std::memory_order_relaxed);
+        }
+        slot.max[type].store(0, std::memory_order_relaxed);
+    }
+    slot.epoch.store(epoch, std::memory_order_release);
+}
+
+void FrameStats::record(FrameStatType type, double start, double end) {
+    uint64_t epoch = (uint64_t)(end / FRAME_STATS_SLOT_MS);
+    Slot &slot = slots[epoch % FRAME_STATS_SLOTS];
+    if (slot.epoch.load(std::memory_order_relaxed) != epoch) {
+        resetSlot(slot, epoch);
+    }
+
+    double us = (end - start) * 1000.0;
+    uint32_t value = us <= 0.0 ? 0 :
+                     us >= MAX_MICROSECONDS ? MAX_MICROSECONDS : (uint32_t)us;
+    slot.counts[type][bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    // Single writer, a plain compare is enough
+    if (value > slot.max[type].load(std::memory_order_relaxed)) {
+        slot.max[type].store(value, std::memory_order_relaxed);
+    }
+
+    if (type == FRAME_STAT_CPU_FRAME) {
+        if (lastReport == 0.0) {
+            lastReport = end;
+        } else if (end - lastReport >= REPORT_INTERVAL) {
+            report();
+            lastReport = end;
+        }
+    }
+}
+
+// Seqlock read: the copy only counts if the slot held the same second
+// before and after it, otherwise a reset ran meanwhile and the copy may mix
+// two periods. Such a slot was just recycled and is read again.
+bool FrameStats::readSlot(const Slot &slot, FrameStatType type, uint64_t now,
+                          uint32_t *counts, uint32_t *max) const {
+    for (uint32_t attempt = 0; attempt < SLOT_READ_ATTEMPTS; attempt++) {
+        uint64_t epoch = slot.epoch.load(std::memory_order_acquire);
+        if (epoch == kSlotUnused || epoch > now ||
+            now - epoch >= FRAME_STATS_SLOTS) {
+            return false;
+        }
+        for (uint32_t i = 0; i < FRAME_STATS_BUCKETS; i++) {
+            counts[i] = slot.counts[type][i].load(std::memory_order_relaxed);
+        }
+        *max = slot.max[type].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.epoch.load(std::memory_order_relaxed) == epoch) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FrameStats::getSummary(FrameStatType type,
+                            frame_stat_summary *summary) const {
+    uint64_t now = (uint64_t)(getTimeMs() / FRAME_STATS_SLOT_MS);
+    uint32_t counts[FRAME_STATS_BUCKETS] = {};
+    uint32_t total = 0;
+    uint32_t max = 0;
+
+    for (uint32_t s = 0; s < FRAME_STATS_SLOTS; s++) {
+        const Slot &slot = slots[s];
+        uint32_t slotCounts[FRAME_STATS_BUCKETS];
+        uint32_t slotMax;
+        if (!readSlot(slot, type, now, slotCounts, &slotMax)) {
+            continue;
+        }
+        for (uint32_t i = 0; i < FRAME_STATS_BUCKETS; i++) {
+            counts[i] += slotCounts[i];
+            total += slotCounts[i];
+        }
+        if (slotMax > max) {
+            max = slotMax;
+        }
+    }
+
+    summary->count = total;
+    if (total == 0) {
+        summary->p50 = summary->p90 = summary->p99 = summary->max = 0.0f;
+        return false;
+    }
+
+    // Smallest bucket that holds at least the given share of the samples
+    const float percentiles[3] = { 0.50f, 0.90f, 0.99f };
+    float *results[3] = { &summary->p50, &summary->p90, &summary->p99 };
+    uint32_t p = 0;
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < FRAME_STATS_BUCKETS && p < 3; i++) {
+        seen += counts[i];
+        while (p < 3 && seen >= percentiles[p] * total) {
+            *results[p++] = bucketValue(i);
+        }
+    }
+    summary->max = max / 1000.0f;
+    return true;
+}
+
+void FrameStats::report() const {
+    for (uint32_t type = 0; type < FRAME_STAT_NUM; type++) {
+        frame_stat_summary summary;
+        if (!getSummary((FrameStatType)type, &summary)) {
+            continue;
+        }
+        LOGI("%-10s p50 %.3f p90 %.3f p99 %.3f max %.3f ms (%u samples)",
+             kStatNames[type], summary.p50, summary.p90, summary.p99,
+             summary.max, summary.count);
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_FRAMESTATS_H
+#define VULKANTEAPOT_FRAMESTATS_H
+
+#include <stdint.h>
+#include <atomic>
+
+/* Phases of a frame that are timed separately */
+enum FrameStatType {
+    FRAME_STAT_CPU_FRAME,   // whole draw() call
+    FRAME_STAT_ACQUIRE,     // blocked in vkAcquireNextImageKHR
+    FRAME_STAT_SUBMIT,      // uniform update, recording and vkQueueSubmit
+    FRAME_STAT_FENCE_WAIT,  // waiting for the GPU to retire older frames
+    FRAME_STAT_PRESENT,     // vkQueuePresentKHR
+    FRAME_STAT_NUM
+};
+
+/*
+ * Percentiles of one frame phase over the rolling window, in milliseconds.
+ * Values come from histogram buckets and are accurate to about 3%.
+ */
+typedef struct _frame_stat_summary {
+    uint32_t count;
+    float p50;
+    float p90;
+    float p99;
+    float max;
+} frame_stat_summary;
+
+/* Values are bucketed logarithmically with 16 buckets per power of two  */
+/* of microseconds, the last bucket collects everything above ~4 s.      */
+#define FRAME_STATS_BUCKETS 304
+
+/* The rolling window is made of this many slots of FRAME_STATS_SLOT_MS */
+#define FRAME_STATS_SLOTS 5
+#define FRAME_STATS_SLOT_MS 1000.0
+
+/*
+ * Fixed-size histograms of frame phase durations. One thread records, the
+ * render thread in practice, any thread may query the summaries without
+ * locking. A slot is cleared when its second comes around again, so the
+ * summaries cover the last FRAME_STATS_SLOTS seconds.
+ */
+class FrameStats {
+public:
+    FrameStats();
+
+    // Writer side. start and end are CLOCK_MONOTONIC times in milliseconds.
+    // CPU frame time is recorded last in every frame and also drives the
+    // periodic log summary.
+    void record(FrameStatType type, double start, double end);
+
+    // Reader side, false when nothing was recorded in the window
+    bool getSummary(FrameStatType type, frame_stat_summary *summary) const;
+    void report() const;
+
+private:
+    struct Slot {
+        // Second this slot holds, kSlotUnused while it is being cleared
+        std::atomic<uint64_t> epoch;
+        std::atomic<uint32_t> counts[FRAME_STAT_NUM][FRAME_STATS_BUCKETS];
+        std::atomic<uint32_t> max[FRAME_STAT_NUM];  // microseconds
+    };
+
+    Slot slots[FRAME_STATS_SLOTS];
+    double lastReport;
+
+    void resetSlot(Slot &slot, uint64_t epoch);
+    // Copies one type of a live slot, false if it is outside the window
+    bool readSlot(const Slot &slot, FrameStatType type, uint64_t now,
+                  uint32_t *counts, uint32_t *max) const;
+};
+
+#endif //VULKANTEAPOT_FRAMESTATS_H
@@ -0,0 +1,542 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cassert>
+#include <cstdio>
+#include <set>
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+#include "GpuAllocator.h"
+
+static const char* kTAG = "GpuAllocator";
+#ifdef __ANDROID__
+#define LOGI(...) \
+  ((void)__android_log_print(ANDROID_LOG_INFO, kTAG, __VA_ARGS__))
+#define LOGE(...) \
+  ((void)__android_log_print(ANDROID_LOG_ERROR, kTAG, __VA_ARGS__))
+#else
+#define LOGI(...) \
+  ((void)(printf("%s: ", kTAG), printf(__VA_ARGS__), putchar('\n')))
+#define LOGE(...) \
+  ((void)(fprintf(stderr, "%s: ", kTAG), fprintf(stderr, __VA_ARGS__), \
+          fputc('\n', stderr)))
+#endif
+
+/* Largest block size, smaller heaps get blocks of an eighth of the heap */
+#define BLOCK_SIZE (32ull << 20)
+/* Smallest buddy, anything smaller is rounded up to it */
+#define MIN_ALLOCATION_SIZE 256ull
+
+static const double kMiB = 1024.0 * 1024.0;
+
+static const char *kUsageNames[MEMORY_USAGE_NUM] = {
+        "gpu only", "cpu to gpu", "upload", "readback", "transient attachment",
+};
+
+/*
+ * Flags a usage cannot work without, flags it benefits from and flags it
+ * would rather avoid. The weights keep one preferred flag above any number
+ * of heap size points.
+ */
+typedef struct _usage_rule {
+    VkMemoryPropertyFlags required;
+    VkMemoryPropertyFlags preferred;
+    VkMemoryPropertyFlags avoided;
+} usage_rule;
+
+static const usage_rule kUsageRules[MEMORY_USAGE_NUM] = {
+        // GPU only: device local, leave host visible memory to the others
+        { 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT },
+        // CPU to GPU: no flush with coherent memory, device local if the
+        // device has such host visible memory. Cached memory only slows
+        // down write-only streams.
+        { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+          VK_MEMORY_PROPERTY_HOST_CACHED_BIT },
+        // Upload: the staging code does not flush. Keeps out of the small
+        // device local host visible heap of discrete GPUs.
+        { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+          VK_MEMORY_PROPERTY_HOST_CACHED_BIT },
+        // Readback: uncached reads are very slow, the readback code does
+        // not invalidate
+        { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 0 },
+        // Transient attachment: lazily allocated memory may never be backed
+        { 0, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT |
+             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT },
+};
+
+static VkDeviceSize roundUpPow2(VkDeviceSize value) {
+    VkDeviceSize result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+static VkDeviceSize roundDownPow2(VkDeviceSize value) {
+    VkDeviceSize result = 1;
+    while (result * 2 <= value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+/*
+ * One VkDeviceMemory split by a binary buddy allocator. Level 0 is the
+ * whole block, every level below halves the size. Each level keeps its free
+ * offsets sorted so allocations are packed towards the start of the block.
+ */
+class GpuBlock {
+public:
+    GpuBlock(VkDeviceMemory memory, VkDeviceSize size, uint8_t *mapped)
+        : memory(memory), size(size), mapped(mapped), usedBytes(0),
+          requestedBytes(0), allocationCount(0)
+    {
+        uint32_t levels = 1;
+        while ((size >> (levels - 1)) > MIN_ALLOCATION_SIZE) {
+            levels++;
+        }
+        freeLists.resize(levels);
+        freeLists[0].insert(0);
+    }
+
+    VkDeviceSize levelSize(uint32_t level) {
+        return size >> level;
+    }
+
+    // Level whose size is the smallest power of two holding size bytes
+    uint32_t levelFor(VkDeviceSize bytes) {
+        uint32_t level = 0;
+        while (level + 1 < freeLists.size() && levelSize(level + 1) >= bytes) {
+            level++;
+        }
+        return level;
+    }
+
+    bool allocate(VkDeviceSize bytes, VkDeviceSize requested,
+                  VkDeviceSize *offset, uint32_t *level) {
+        uint32_t target = levelFor(bytes);
+        // Smallest free buddy that is big enough
+        int32_t found = (int32_t)target;
+        while (found >= 0 && freeLists[found].empty()) {
+            found--;
+        }
+        if (found < 0) {
+            return false;
+        }
+        VkDeviceSize start = *freeLists[found].begin();
+        freeLists[found].erase(freeLists[found].begin());
+        // Split down to the target, keeping the upper halves free
+        for (uint32_t l = (uint32_t)found; l < target; l++) {
+            freeLists[l + 1].insert(start + levelSize(l + 1));
+        }
+        *offset = start;
+        *level = target;
+        usedBytes += levelSize(target);
+        requestedBytes += requested;
+        allocationCount++;
+        return true;
+    }
+
+    void free(VkDeviceSize offset, uint32_t level, VkDeviceSize requested) {
+        usedBytes -= levelSize(level);
+        requestedBytes -= requested;
+        allocationCount--;
+        // Merge with the buddy for as long as it is free too
+        while (level > 0) {
+            VkDeviceSize buddy = offset ^ levelSize(level);
+            std::set<VkDeviceSize>::iterator it = freeLists[level].find(buddy);
+            if (it == freeLists[level].end()) {
+                break;
+            }
+            freeLists[level].erase(it);
+            if (buddy < offset) {
+                offset = buddy;
+            }
+            level--;
+        }
+        freeLists[level].insert(offset);
+    }
+
+    VkDeviceSize largestFreeRange() {
+        for (uint32_t l = 0; l < freeLists.size(); l++) {
+            if (!freeLists[l].empty()) {
+                return levelSize(l);
+            }
+        }
+        return 0;
+    }
+
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint8_t *mapped;
+    VkDeviceSize usedBytes;
+    VkDeviceSize requestedBytes;
+    uint32_t allocationCount;
+
+private:
+    std::vector<std::set<VkDeviceSize> > freeLists;
+};
+
+GpuAllocator::GpuAllocator()
+    : device(VK_NULL_HANDLE), registry(nullptr), bufferImageGranularity(1),
+      maxAllocationCount(0), dedicatedCount(0), dedicatedBytes(0),
+      lazyBytes(0)
+{
+}
+
+void GpuAllocator::init(VkPhysicalDevice gpu, VkDevice device,
+                        ResourceRegistry *registry) {
+    this->device = device;
+    this->registry = registry;
+    vkGetPhysicalDeviceMemoryProperties(gpu, &memoryProperties);
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(gpu, &props);
+    bufferImageGranularity = props.limits.bufferImageGranularity;
+    maxAllocationCount = props.limits.maxMemoryAllocationCount;
+
+    // Two pools per memory type, the second one only used for optimal
+    // images when the granularity forces them apart
+    pools.resize(memoryProperties.memoryTypeCount * 2);
+    for (uint32_t i = 0; i < pools.size(); i++) {
+        uint32_t type = i / 2;
+        VkDeviceSize heapSize = memoryProperties.memoryHeaps[
+                memoryProperties.memoryTypes[type].heapIndex].size;
+        pools[i].memoryType = type;
+        pools[i].blockSize = roundDownPow2(heapSize / 8);
+        if (pools[i].blockSize > BLOCK_SIZE) {
+            pools[i].blockSize = BLOCK_SIZE;
+        }
+    }
+    LOGI("bufferImageGranularity %u, maxMemoryAllocationCount %u",
+         (uint32_t)bufferImageGranularity, maxAllocationCount);
+}
+
+void GpuAllocator::destroy() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < pools.size(); i++) {
+        for (size_t b = 0; b < pools[i].blocks.size(); b++) {
+            GpuBlock *block = pools[i].blocks[b];
+            if (block->allocationCount) {
+                LOGE("memory type %u: %u allocations still alive",
+                     pools[i].memoryType, block->allocationCount);
+            }
+            freeMemory(block->memory);
+            delete block;
+        }
+        pools[i].blocks.clear();
+    }
+    if (dedicatedCount) {
+        LOGE("%u dedicated allocations still alive", dedicatedCount);
+    }
+}
+
+bool GpuAllocator::allocateMemory(uint32_t memoryType, VkDeviceSize size,
+                                  const char *name, VkDeviceMemory *memory,
+                                  uint8_t **mapped) {
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    VkResult res = vkAllocateMemory(device, &allocInfo, nullptr, memory);
+    if (res != VK_SUCCESS) {
+        LOGE("vkAllocateMemory of %.2f MiB in type %u failed: %d",
+             size / kMiB, memoryType, res);
+        return false;
+    }
+
+    *mapped = nullptr;
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        res = vkMapMemory(device, *memory, 0, VK_WHOLE_SIZE, 0,
+                          (void **)mapped);
+        if (res != VK_SUCCESS) {
+            LOGE("vkMapMemory in type %u failed: %d", memoryType, res);
+            vkFreeMemory(device, *memory, nullptr);
+            return false;
+        }
+    }
+    registry->track(RESOURCE_DEVICE_MEMORY, *memory, name, size,
+                    (memoryProperties.memoryTypes[memoryType].propertyFlags &
+                     VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0);
+    return true;
+}
+
+void GpuAllocator::freeMemory(VkDeviceMemory memory) {
+    registry->untrack(RESOURCE_DEVICE_MEMORY, memory);
+    vkFreeMemory(device, memory, nullptr);
+}
+
+bool GpuAllocator::allocate(const VkMemoryRequirements &requirements,
+                            uint32_t memoryType, bool optimalImage,
+                            gpu_allocation *allocation) {
+    assert(requirements.memoryTypeBits & (1u << memoryType));
+    std::lock_guard<std::mutex> guard(lock);
+
+    allocation->memoryType = memoryType;
+    allocation->size = requirements.size;
+
+    pool &p = pools[memoryType * 2 +
+                    (optimalImage && bufferImageGranularity > 1 ? 1 : 0)];
+    VkDeviceSize bytes = requirements.size;
+    if (bytes < requirements.alignment) {
+        bytes = requirements.alignment;
+    }
+    bytes = roundUpPow2(bytes);
+
+    bool lazy = (memoryProperties.memoryTypes[memoryType].propertyFlags &
+                 VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+    if (lazy || bytes > p.blockSize / 4) {
+        uint8_t *mapped;
+        if (!allocateMemory(memoryType, requirements.size,
+                            lazy ? "lazily allocated" : "dedicated",
+                            &allocation->memory, &mapped)) {
+            return false;
+        }
+        allocation->offset = 0;
+        allocation->mapped = mapped;
+        allocation->block = nullptr;
+        allocation->level = 0;
+        dedicatedCount++;
+        dedicatedBytes += requirements.size;
+        if (lazy) {
+            lazyMemory.push_back(allocation->memory);
+            lazyBytes += requirements.size;
+        }
+        return true;
+    }
+
+    // Buddy offsets are multiples of their size, alignment comes for free
+    for (size_t b = 0; b < p.blocks.size(); b++) {
+        GpuBlock *block = p.blocks[b];
+        if (block->allocate(bytes, requirements.size, &allocation->offset,
+                            &allocation->level)) {
+            allocation->memory = block->memory;
+            allocation->mapped =
+                    block->mapped ? block->mapped + allocation->offset : nullptr;
+            allocation->block = block;
+            return true;
+        }
+    }
+
+    VkDeviceMemory memory;
+    uint8_t *mapped;
+    if (!allocateMemory(memoryType, p.blockSize, "pool block", &memory,
+                        &mapped)) {
+        return false;
+    }
+    GpuBlock *block = new GpuBlock(memory, p.blockSize, mapped);
+    p.blocks.push_back(block);
+    // A fresh block always holds a quarter block request
+    bool pass = block->allocate(bytes, requirements.size, &allocation->offset,
+                                &allocation->level);
+    assert(pass);
+    (void)pass;
+    allocation->memory = memory;
+    allocation->mapped = mapped ? mapped + allocation->offset : nullptr;
+    allocation->block = block;
+    return true;
+}
+
+void GpuAllocator::free(gpu_allocation *allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+
+    GpuBlock *block = allocation->block;
+    if (!block) {
+        for (size_t i = 0; i < lazyMemory.size(); i++) {
+            if (lazyMemory[i] == allocation->memory) {
+                lazyMemory.erase(lazyMemory.begin() + i);
+                lazyBytes -= allocation->size;
+                break;
+            }
+        }
+        freeMemory(allocation->memory);
+        dedicatedCount--;
+        dedicatedBytes -= allocation->size;
+    } else {
+        block->free(allocation->offset, allocation->level, allocation->size);
+        // Keep one empty block per pool around for the next allocation
+        if (!block->allocationCount) {
+            for (size_t i = 0; i < pools.size(); i++) {
+                std::vector<GpuBlock *> &blocks = pools[i].blocks;
+                for (size_t b = 0; b < blocks.size(); b++) {
+                    if (blocks[b] == block && blocks.size() > 1) {
+                        freeMemory(block->memory);
+                        delete block;
+                        blocks.erase(blocks.begin() + b);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    allocation->memory = VK_NULL_HANDLE;
+    allocation->mapped = nullptr;
+    allocation->block = nullptr;
+}
+
+// 100 points per preferred flag, -100 per avoided one, and log2 of the heap
+// size in MiB, at most 20 points, so the main heap wins ties
+int32_t GpuAllocator::scoreMemoryType(uint32_t memoryType, MemoryUsage usage) {
+    const usage_rule &rule = kUsageRules[usage];
+    VkMemoryPropertyFlags flags =
+            memoryProperties.memoryTypes[memoryType].propertyFlags;
+    if ((flags & rule.required) != rule.required) {
+        return -1;
+    }
+    int32_t score = 1000;
+    for (uint32_t bit = 1; bit; bit <<= 1) {
+        if (rule.preferred & flags & bit) {
+            score += 100;
+        }
+        if (rule.avoided & flags & bit) {
+            score -= 100;
+        }
+    }
+    VkDeviceSize heapMiB = memoryProperties.memoryHeaps[
+            memoryProperties.memoryTypes[memoryType].heapIndex].size >> 20;
+    for (int32_t points = 0; heapMiB > 1 && points < 20; points++) {
+        heapMiB >>= 1;
+        score++;
+    }
+    return score;
+}
+
+bool GpuAllocator::findMemoryType(uint32_t typeBits, MemoryUsage usage,
+                                  uint32_t *memoryType) {
+    std::lock_guard<std::mutex> guard(lock);
+    uint64_t key = ((uint64_t)usage << 32) | typeBits;
+    std::map<uint64_t, uint32_t>::iterator it = typeCache.find(key);
+    if (it == typeCache.end()) {
+        uint32_t best = UINT32_MAX;
+        int32_t bestScore = -1;
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            if (!(typeBits & (1u << i))) {
+                continue;
+            }
+            int32_t score = scoreMemoryType(i, usage);
+            if (score > bestScore) {
+                best = i;
+                bestScore = score;
+            }
+        }
+        if (best == UINT32_MAX) {
+            LOGE("no memory type for %s in 0x%x", kUsageNames[usage],
+                 typeBits);
+        } else {
+            LOGI("%s memory: type %u, flags 0x%x, heap %.0f MiB",
+                 kUsageNames[usage], best,
+                 memoryProperties.memoryTypes[best].propertyFlags,
+                 memoryProperties.memoryHeaps[
+                         memoryProperties.memoryTypes[best].heapIndex].size /
+                 kMiB);
+        }
+        it = typeCache.insert(std::make_pair(key, best)).first;
+    }
+    *memoryType = it->second;
+    return it->second != UINT32_MAX;
+}
+
+VkMemoryPropertyFlags GpuAllocator::getMemoryTypeFlags(uint32_t memoryType) {
+    return memoryProperties.memoryTypes[memoryType].propertyFlags;
+}
+
+void GpuAllocator::addStats(const pool &p, gpu_memory_stats *stats) {
+    for (size_t b = 0; b < p.blocks.size(); b++) {
+        GpuBlock *block = p.blocks[b];
+        stats->blockCount++;
+        stats->allocationCount += block->allocationCount;
+        stats->blockBytes += block->size;
+        stats->requestedBytes += block->requestedBytes;
+        stats->usedBytes += block->usedBytes;
+        VkDeviceSize largest = block->largestFreeRange();
+        if (largest > stats->largestFreeRange) {
+            stats->largestFreeRange = largest;
+        }
+    }
+}
+
+void GpuAllocator::getStats(gpu_memory_stats *stats) {
+    std::lock_guard<std::mutex> guard(lock);
+    *stats = {};
+    for (size_t i = 0; i < pools.size(); i++) {
+        addStats(pools[i], stats);
+    }
+    stats->dedicatedCount = dedicatedCount;
+    stats->dedicatedBytes = dedicatedBytes;
+    stats->lazyBytes = lazyBytes;
+    stats->lazyCommittedBytes = getLazyCommittedBytes();
+}
+
+// Tiles that never spill leave lazily allocated memory uncommitted
+VkDeviceSize GpuAllocator::getLazyCommittedBytes() {
+    VkDeviceSize committed = 0;
+    for (size_t i = 0; i < lazyMemory.size(); i++) {
+        VkDeviceSize bytes = 0;
+        vkGetDeviceMemoryCommitment(device, lazyMemory[i], &bytes);
+        committed += bytes;
+    }
+    return committed;
+}
+
+// Rounding waste is what the buddy sizes add on top of the requests,
+// fragmentation is the share of free block memory that the largest free
+// range does not cover
+void GpuAllocator::report() {
+    std::lock_guard<std::mutex> guard(lock);
+    gpu_memory_stats total = {};
+    for (size_t i = 0; i < pools.size(); i++) {
+        if (pools[i].blocks.empty()) {
+            continue;
+        }
+        gpu_memory_stats stats = {};
+        addStats(pools[i], &stats);
+        VkDeviceSize freeBytes = stats.blockBytes - stats.usedBytes;
+        LOGI("type %u%s: %u blocks %.2f MiB, %u allocations %.2f MiB "
+             "(%.2f MiB rounding), fragmentation %.1f%%",
+             pools[i].memoryType, (i & 1) ? " optimal images" : "",
+             stats.blockCount, stats.blockBytes / kMiB,
+             stats.allocationCount, stats.requestedBytes / kMiB,
+             (stats.usedBytes - stats.requestedBytes) / kMiB,
+             freeBytes ? 100.0 * (1.0 - (double)stats.largestFreeRange /
+                                        freeBytes) : 0.0);
+        addStats(pools[i], &total);
+    }
+    LOGI("total: %u device memory objects (%u dedicated %.2f MiB) of %u "
+         "allowed, %u sub-allocations, %.2f of %.2f MiB in blocks used",
+         total.blockCount + dedicatedCount, dedicatedCount,
+         dedicatedBytes / kMiB, maxAllocationCount, total.allocationCount,
+         total.usedBytes / kMiB, total.blockBytes / kMiB);
+    if (lazyBytes) {
+        VkDeviceSize committed = getLazyCommittedBytes();
+        LOGI("lazily allocated: %u objects %.2f MiB, %.2f MiB committed, "
+             "%.2f MiB saved", (uint32_t)lazyMemory.size(), lazyBytes / kMiB,
+             committed / kMiB, (lazyBytes - committed) / kMiB);
+    }
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_GPUALLOCATOR_H
+#define VULKANTEAPOT_GPUALLOCATOR_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <vector>
+#ifdef __ANDROID__
+#include "vulkan_wrapper.h"
+#else
+#include <vulkan/vulkan.h>
+#endif
+#include "ResourceRegistry.h"
+
+class GpuBlock;
+
+/*
+ * What a resource's memory is used for. Picks the memory type, the wrong
+ * one works but can be much slower, e.g. reading back from write-combined
+ * memory or rendering from host memory on a discrete GPU.
+ */
+enum MemoryUsage {
+    // Only touched by the GPU: attachments, static geometry
+    MEMORY_USAGE_GPU_ONLY,
+    // Written by the CPU every frame, read by the GPU: uniforms
+    MEMORY_USAGE_CPU_TO_GPU,
+    // Written once by the CPU and copied by the GPU: staging buffers
+    MEMORY_USAGE_UPLOAD,
+    // Written by the GPU, read by the CPU
+    MEMORY_USAGE_READBACK,
+    // Attachments that never leave tile memory, lazily allocated if possible
+    MEMORY_USAGE_TRANSIENT_ATTACHMENT,
+    MEMORY_USAGE_NUM,
+};
+
+/*
+ * A piece of device memory handed out by GpuAllocator. Bind resources at
+ * memory + offset. mapped points at offset when the memory type is host
+ * visible, blocks stay mapped for their whole lifetime.
+ */
+typedef struct _gpu_allocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint8_t *mapped;
+    uint32_t memoryType;
+    // NULL for dedicated allocations
+    GpuBlock *block;
+    uint32_t level;
+} gpu_allocation;
+
+typedef struct _gpu_memory_stats {
+    // Live VkDeviceMemory objects, to compare with maxMemoryAllocationCount
+    uint32_t blockCount;
+    uint32_t dedicatedCount;
+    // Live sub-allocations in blocks
+    uint32_t allocationCount;
+    VkDeviceSize blockBytes;
+    VkDeviceSize dedicatedBytes;
+    // Sizes asked for, and the same rounded up to buddy sizes
+    VkDeviceSize requestedBytes;
+    VkDeviceSize usedBytes;
+    // Biggest allocation that fits without a new block
+    VkDeviceSize largestFreeRange;
+    // Dedicated allocations in lazily allocated memory, and how much of
+    // them the driver has actually backed. The rest is what transient
+    // attachments saved.
+    VkDeviceSize lazyBytes;
+    VkDeviceSize lazyCommittedBytes;
+} gpu_memory_stats;
+
+/*
+ * Pooled device memory. Every memory type gets a list of large blocks,
+ * each carved up by a buddy allocator, so resources no longer cost one
+ * vkAllocateMemory each. Requests larger than a quarter of a block get
+ * memory of their own, and so do lazily allocated types, whose backing is
+ * committed per memory object.
+ *
+ * Buffers and optimal tiling images are kept in separate pools when
+ * bufferImageGranularity is above 1, so they never share a granularity page.
+ */
+class GpuAllocator {
+public:
+    GpuAllocator();
+
+    // Device memory objects are tracked in registry
+    void init(VkPhysicalDevice gpu, VkDevice device,
+              ResourceRegistry *registry);
+    // Frees every block, resources bound to them must be destroyed first
+    void destroy();
+
+    // memoryType is an index valid for requirements.memoryTypeBits.
+    // optimalImage is true for images created with VK_IMAGE_TILING_OPTIMAL.
+    bool allocate(const VkMemoryRequirements &requirements,
+                  uint32_t memoryType, bool optimalImage,
+                  gpu_allocation *allocation);
+    void free(gpu_allocation *allocation);
+
+    // Best scored type in typeBits for usage, remembered per usage and
+    // typeBits. Fails when no type has the flags usage cannot do without.
+    bool findMemoryType(uint32_t typeBits, MemoryUsage usage,
+                        uint32_t *memoryType);
+    VkMemoryPropertyFlags getMemoryTypeFlags(uint32_t memoryType);
+
+    void getStats(gpu_memory_stats *stats);
+    // Logs usage and fragmentation per memory type and in total
+    void report();
+
+private:
+    typedef struct _pool {
+        uint32_t memoryType;
+        VkDeviceSize blockSize;
+        std::vector<GpuBlock *> blocks;
+    } pool;
+
+    VkDevice device;
+    ResourceRegistry *registry;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize bufferImageGranularity;
+    uint32_t maxAllocationCount;
+    std::vector<pool> pools;
+    uint32_t dedicatedCount;
+    VkDeviceSize dedicatedBytes;
+    // Dedicated allocations of lazily allocated types
+    std::vector<VkDeviceMemory> lazyMemory;
+    VkDeviceSize lazyBytes;
+    std::mutex lock;
+    // (usage << 32 | typeBits) to the chosen type, or UINT32_MAX
+    std::map<uint64_t, uint32_t> typeCache;
+
+    bool allocateMemory(uint32_t memoryType, VkDeviceSize size,
+                        const char *name, VkDeviceMemory *memory,
+                        uint8_t **mapped);
+    void freeMemory(VkDeviceMemory memory);
+    void addStats(const pool &p, gpu_memory_stats *stats);
+    VkDeviceSize getLazyCommittedBytes();
+    int32_t scoreMemoryType(uint32_t memoryType, MemoryUsage usage);
+};
+
+#endif //VULKANTEAPOT_GPUALLOCATOR_H
@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Headless entry point for Linux. Renders the teapot into offscreen images
+// on any Vulkan implementation, lavapipe included, reports the frame time
+// and optionally writes the last frame to a PPM file. --transform both
+// compares the uniform buffer and push constant paths. --bench-matrices
+// times the batched transform kernel against glm and --bench-vertices the
+// vertex packer, neither touches Vulkan.
+// Not part of the Android build.
+#ifndef __ANDROID__
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <vector>
+#include "VulkanDevice.h"
+#include "MatrixBatch.h"
+#include "VertexPacker.h"
+#include "glm/gtc/matrix_transform.hpp"
+
+static const char *kTransformPathNames[] = { "uniform buffer", "push constants" };
+
+struct options {
+    uint32_t width;
+    uint32_t height;
+    uint32_t frames;
+    uint32_t framesInFlight;
+    uint32_t objects;
+    float angle;
+    const char *output;
+    const char *mesh;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [--width N] [--height N] [--frames N] "
+            "[--frames-in-flight N] [--objects N] [--transform ubo|push|both] "
+            "[--angle DEG] [--output FILE.ppm] [--mesh FILE.mesh] "
+            "[--bench-matrices N] [--bench-vertices N]\n",
+            name);
+}
+
+static bool writePPM(const char *path, uint32_t width, uint32_t height,
+                     const std::vector<uint8_t> &rgba) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    for (size_t i = 0; i < rgba.size(); i += 4) {
+        fwrite(&rgba[i], 1, 3, file);
+    }
+    fclose(file);
+    return true;
+}
+
+static double getTimeMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// Nanoseconds per matrix of view-projection times count model matrices,
+// plain glm into an array against the batch kernel into an array and into
+// a buffer laid out like the uniform arena
+static void benchMatrices(uint32_t count) {
+    const size_t uniformStride = 256;
+    std::vector<glm::mat4> models(count);
+    for (uint32_t i = 0; i < count; i++) {
+        models[i] = glm::translate(glm::mat4(1.0f),
+                                   glm::vec3(i * 0.5f, 1.0f, -2.0f));
+    }
+    glm::mat4 viewProjection =
+            glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, 300.0f) *
+            glm::lookAt(glm::vec3(30, -200, 20), glm::vec3(0, 0, 0),
+                        glm::vec3(0, 0, 1));
+    std::vector<glm::mat4> reference(count);
+    std::vector<glm::mat4> batch(count);
+    std::vector<uint8_t> uniform(uniformStride * count);
+
+    // Enough rounds for roughly 10M products per variant
+    uint32_t rounds = 10000000 / count + 1;
+    double start = getTimeMs();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < count; i++) {
+            reference[i] = viewProjection * models[i];
+        }
+        viewProjection[3][3] += reference[r % count][0][0] * 1e-30f;
+    }
+    double glmTime = getTimeMs() - start;
+
+    start = getTimeMs();
+    for (uint32_t r = 0; r < rounds; r++) {
+        multiplyBatch(viewProjection, models.data(), count, batch.data(),
+                      sizeof(glm::mat4));
+        viewProjection[3][3] += batch[r % count][0][0] * 1e-30f;
+    }
+    double batchTime = getTimeMs() - start;
+
+    start = getTimeMs();
+    for (uint32_t r = 0; r < rounds; r++) {
+        multiplyBatch(viewProjection, models.data(), count, uniform.data(),
+                      uniformStride);
+        viewProjection[3][3] += uniform[(r % count) * uniformStride] * 1e-30f;
+    }
+    double uniformTime = getTimeMs() - start;
+
+    // The feedback terms above keep the loops from being hoisted, compare
+    // one final pass for correctness
+    for (uint32_t i = 0; i < count; i++) {
+        reference[i] = viewProjection * models[i];
+    }
+    multiplyBatch(viewProjection, models.data(), count, batch.data(),
+                  sizeof(glm::mat4));
+    float maxError = 0.0f;
+    for (uint32_t i = 0; i < count; i++) {
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                float error = fabsf(reference[i][c][r] - batch[i][c][r]);
+                if (error > maxError) {
+                    maxError = error;
+                }
+            }
+        }
+    }
+
+    double products = (double)rounds * count;
+    printf("%u matrices, %s kernel: glm %.2f ns, batch %.2f ns, "
+           "batch to %zu byte stride %.2f ns per matrix, max error %g\n",
+           count, getMatrixBatchPath(), glmTime * 1e6 / products,
+           batchTime * 1e6 / products, uniformStride,
+           uniformTime * 1e6 / products, maxError);
+}
+
+// Fastest of a few passes of one packer over count vertices, in ms
+static double timePack(bool simd, const vertex_layout &layout,
+                       const vertex_stream *streams, size_t count,
+                       void *const *dst) {
+    double best = 0.0;
+    for (int pass = 0; pass < 3; pass++) {
+        double start = getTimeMs();
+        if (simd) {
+            packVertices(&layout, streams, count, dst);
+        } else {
+            packVerticesScalar(&layout, streams, count, dst);
+        }
+        double time = getTimeMs() - start;
+        if (pass == 0 || time < best) {
+            best = time;
+        }
+    }
+    return best;
+}
+
+// Packs count synthetic vertices with all five teapot attributes into
+// float, quantized interleaved and quantized split layouts, scalar against
+// SIMD. Throughput counts the float source read and the vertices written.
+static void benchVertices(uint32_t count) {
+    static const uint32_t kComponents[MESH_ATTRIBUTE_SEMANTIC_NUM] = {
+            3, 3, 2, 3, 3 };
+    std::vector<float> sources[MESH_ATTRIBUTE_SEMANTIC_NUM];
+    vertex_stream streams[MESH_ATTRIBUTE_SEMANTIC_NUM];
+    size_t sourceBytes = 0;
+    uint32_t seed = 1;
+    for (uint32_t s = 0; s < MESH_ATTRIBUTE_SEMANTIC_NUM; s++) {
+        uint32_t components = kComponents[s];
+        sources[s].resize((size_t)count * components);
+        for (size_t v = 0; v < count; v++) {
+            float *dst = &sources[s][v * components];
+            float length = 0.0f;
+            for (uint32_t c = 0; c < components; c++) {
+                seed = seed * 1664525u + 1013904223u;
+                dst[c] = (seed >> 8) / 16777216.0f * 2.0f - 1.0f;
+                length += dst[c] * dst[c];
+            }
+            // Positions span a teapot sized box, directions are unit
+            for (uint32_t c = 0; c < components; c++) {
+                if (s == MESH_ATTRIBUTE_POSITION) {
+                    dst[c] *= 40.0f;
+                } else if (s == MESH_ATTRIBUTE_TEXCOORD) {
+                    dst[c] = dst[c] * 2.0f + 2.0f;
+                } else if (length > 0.0f) {
+                    dst[c] /= sqrtf(length);
+                }
+            }
+        }
+        streams[s].data = sources[s].data();
+        streams[s].components = components;
+        streams[s].stride = 0;
+        sourceBytes += components * sizeof(float);
+    }
+
+    static const uint32_t kFloatFormats[MESH_ATTRIBUTE_SEMANTIC_NUM] = {
+            MESH_FORMAT_FLOAT32X3, MESH_FORMAT_FLOAT32X3,
+            MESH_FORMAT_FLOAT32X2, MESH_FORMAT_FLOAT32X3,
+            MESH_FORMAT_FLOAT32X3 };
+    static const uint32_t kQuantizedFormats[MESH_ATTRIBUTE_SEMANTIC_NUM] = {
+            MESH_FORMAT_SNORM16X4, MESH_FORMAT_OCT_SNORM16X2,
+            MESH_FORMAT_FLOAT16X2, MESH_FORMAT_OCT_SNORM16X2,
+            MESH_FORMAT_UNORM10X3 };
+    static const char *const kLayoutNames[] = {
+            "float interleaved", "quantized interleaved", "quantized split" };
+    for (int l = 0; l < 3; l++) {
+        vertex_layout layout;
+        initVertexLayout(&layout);
+        for (int c = 0; c < 3; c++) {
+            layout.positionScale[c] = 40.0f;
+        }
+        // The split layout keeps positions alone for depth only passes
+        for (uint32_t s = 0; s < MESH_ATTRIBUTE_SEMANTIC_NUM; s++) {
+            addVertexAttribute(&layout, s,
+                               l ? kQuantizedFormats[s] : kFloatFormats[s],
+                               l == 2 && s != MESH_ATTRIBUTE_POSITION);
+        }
+        std::vector<uint8_t> simd[VERTEX_LAYOUT_MAX_BINDINGS];
+        std::vector<uint8_t> scalar[VERTEX_LAYOUT_MAX_BINDINGS];
+        void *simdDst[VERTEX_LAYOUT_MAX_BINDINGS];
+        void *scalarDst[VERTEX_LAYOUT_MAX_BINDINGS];
+        size_t vertexBytes = 0;
+        for (uint32_t b = 0; b < layout.bindingCount; b++) {
+            simd[b].resize((size_t)count * layout.strides[b]);
+            scalar[b].resize(simd[b].size());
+            simdDst[b] = simd[b].data();
+            scalarDst[b] = scalar[b].data();
+            vertexBytes += layout.strides[b];
+        }
+        double scalarTime = timePack(false, layout, streams, count, scalarDst);
+        double simdTime = timePack(true, layout, streams, count, simdDst);
+        bool identical = true;
+        for (uint32_t b = 0; b < layout.bindingCount; b++) {
+            identical = identical && simd[b] == scalar[b];
+        }
+        double bytes = (double)count * (sourceBytes + vertexBytes);
+        printf("%u vertices, %s, %zu bytes per vertex in %u binding%s: "
+               "scalar %.2f ns, %s %.2f ns per vertex, %.0f Mvertices/s, "
+               "%.2f GB/s, %s\n", count, kLayoutNames[l], vertexBytes,
+               layout.bindingCount, layout.bindingCount > 1 ? "s" : "",
+               scalarTime * 1e6 / count, getVertexPackerPath(),
+               simdTime * 1e6 / count, count / simdTime / 1e3,
+               bytes / simdTime / 1e6, identical ? "identical" : "DIFFERENT");
+    }
+}
+
+// Render opts.frames frames with one transform path, returns false on error
+static bool run(const options &opts, TransformPath path) {
+    VulkanDevice *device = new VulkanDevice(opts.width, opts.height,
+                                            opts.framesInFlight, path,
+                                            opts.mesh);
+    if (!device->isReady()) {
+        fprintf(stderr, "Vulkan initialization failed\n");
+        delete device;
+        return false;
+    }
+    device->setObjectCount(opts.objects);
+
+    // Same transform as a drag on the device, fixed so the image can be
+    // compared between runs
+    device->rotateModel(0, opts.angle, 0);
+
+    double fenceWait;
+    double frameTime = device->measureFrameTime(opts.frames, &fenceWait);
+    printf("%s, %ux%u, %u objects, %u frames, framesInFlight=%u: "
+           "frame %.3f ms (%.1f fps), fence wait %.3f ms\n",
+           kTransformPathNames[path], opts.width, opts.height,
+           device->getObjectCount(), opts.frames, device->getFramesInFlight(),
+           frameTime, 1000.0 / frameTime, fenceWait);
+
+    // Uniform writes, recording and submission are the CPU cost of the path
+    frame_stat_summary submit;
+    if (device->getFrameStats(FRAME_STAT_SUBMIT, &submit)) {
+        printf("%s: CPU record+submit p50 %.3f p99 %.3f ms\n",
+               kTransformPathNames[path], submit.p50, submit.p99);
+    }
+    device->reportFrameStats();
+    device->reportMemoryStats();
+    device->reportResources("after run");
+
+    bool ret = true;
+    if (opts.output) {
+        std::vector<uint8_t> rgba;
+        if (!device->readPixels(rgba) ||
+            !writePPM(opts.output, opts.width, opts.height, rgba)) {
+            ret = false;
+        }
+    }
+
+    delete device;
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    options opts;
+    opts.width = 640;
+    opts.height = 480;
+    opts.frames = 300;
+    opts.framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    opts.objects = 1;
+    opts.angle = 0.0f;
+    opts.output = nullptr;
+    opts.mesh = DEFAULT_MESH_PATH;
+    bool runUniform = true;
+    bool runPush = false;
+    uint32_t benchCount = 0;
+    uint32_t benchVertexCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(argv[i - 1], "--width")) {
+            opts.width = strtoul(value, nullptr, 10);
+        } else if (!strcmp(argv[i - 1], "--height")) {
+            opts.height = strtoul(value, nullptr, 10);
+        } else if (!strcmp(argv[i - 1], "--frames")) {
+            opts.frames = strtoul(value, nullptr, 10);
+        } else if (!strcmp(argv[i - 1], "--frames-in-flight")) {
+            opts.framesInFlight = strtoul(value, nullptr, 10);
+        } else if (!strcmp(argv[i - 1], "--objects")) {
+            opts.objects = strtoul(value, nullptr, 10);
+        } else if (!strcmp(argv[i - 1], "--transform")) {
+            runUniform = !strcmp(value, "ubo") || !strcmp(value, "both");
+            runPush = !strcmp(value, "push") || !strcmp(value, "both");
+        } else if (!strcmp(argv[i - 1], "--angle")) {
+            opts.angle = strtof(value, nullptr);
+        } else if (!strcmp(argv[i - 1], "--output")) {
+            opts.output = value;
+        } else if (!strcmp(argv[i - 1], "--mesh")) {
+            opts.mesh = value;
+        } else if (!strcmp(argv[i - 1], "--bench-matrices")) {
+            benchCount = strtoul(value, nullptr, 10);
+        } else if (!strcmp(argv[i - 1], "--bench-vertices")) {
+            benchVertexCount = strtoul(value, nullptr, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (benchCount > 0 || benchVertexCount > 0) {
+        if (benchCount > 0) {
+            benchMatrices(benchCount);
+        }
+        if (benchVertexCount > 0) {
+            benchVertices(benchVertexCount);
+        }
+        return 0;
+    }
+    if (opts.width == 0 || opts.height == 0 || opts.frames == 0 ||
+        (!runUniform && !runPush)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // With both paths the image of the last one is written
+    if (runUniform && !run(opts, TRANSFORM_PATH_UNIFORM_BUFFER)) {
+        return 1;
+    }
+    if (runPush && !run(opts, TRANSFORM_PATH_PUSH_CONSTANTS)) {
+        return 1;
+    }
+    return 0;
+}
+
+#endif // __ANDROID__
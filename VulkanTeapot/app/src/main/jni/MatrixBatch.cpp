@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <stdint.h>
+#include "MatrixBatch.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MATRIX_BATCH_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MATRIX_BATCH_NEON
+#endif
+
+/*
+ * glm matrices are column major, column j of a * b is the sum over k of
+ * column k of a scaled by b[j][k]. Both kernels below compute that with
+ * one register per column of a and a broadcast per element of b.
+ */
+
+#if defined(MATRIX_BATCH_SSE2)
+
+static inline void loadColumns(const float *m, __m128 col[4]) {
+    col[0] = _mm_loadu_ps(m);
+    col[1] = _mm_loadu_ps(m + 4);
+    col[2] = _mm_loadu_ps(m + 8);
+    col[3] = _mm_loadu_ps(m + 12);
+}
+
+static inline __m128 combine(const __m128 col[4], const float *elem) {
+    __m128 sum = _mm_mul_ps(col[0], _mm_set1_ps(elem[0]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(col[1], _mm_set1_ps(elem[1])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(col[2], _mm_set1_ps(elem[2])));
+    return _mm_add_ps(sum, _mm_mul_ps(col[3], _mm_set1_ps(elem[3])));
+}
+
+static inline __m128 combine(const __m128 col[4], const __m128 elem[4]) {
+    __m128 sum = _mm_mul_ps(col[0], elem[0]);
+    sum = _mm_add_ps(sum, _mm_mul_ps(col[1], elem[1]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(col[2], elem[2]));
+    return _mm_add_ps(sum, _mm_mul_ps(col[3], elem[3]));
+}
+
+void multiplyBatch(const glm::mat4 &left, const glm::mat4 *right,
+                   size_t count, void *dst, size_t dstStride) {
+    __m128 col[4];
+    loadColumns(&left[0][0], col);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    for (size_t i = 0; i < count; i++, out += dstStride) {
+        // Broadcasting straight from memory is cheaper than shuffling
+        // loaded columns
+        const float *elem = &right[i][0][0];
+        float *result = reinterpret_cast<float *>(out);
+        _mm_storeu_ps(result, combine(col, elem));
+        _mm_storeu_ps(result + 4, combine(col, elem + 4));
+        _mm_storeu_ps(result + 8, combine(col, elem + 8));
+        _mm_storeu_ps(result + 12, combine(col, elem + 12));
+    }
+}
+
+void multiplyBatch(const glm::mat4 *left, const glm::mat4 &right,
+                   size_t count, void *dst, size_t dstStride) {
+    // right is the same for every product, splat its elements once
+    __m128 elem[16];
+    for (int i = 0; i < 16; i++) {
+        elem[i] = _mm_set1_ps((&right[0][0])[i]);
+    }
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    for (size_t i = 0; i < count; i++, out += dstStride) {
+        __m128 col[4];
+        loadColumns(&left[i][0][0], col);
+        float *result = reinterpret_cast<float *>(out);
+        _mm_storeu_ps(result, combine(col, elem));
+        _mm_storeu_ps(result + 4, combine(col, elem + 4));
+        _mm_storeu_ps(result + 8, combine(col, elem + 8));
+        _mm_storeu_ps(result + 12, combine(col, elem + 12));
+    }
+}
+
+const char *getMatrixBatchPath() {
+    return "SSE2";
+}
+
+#elif defined(MATRIX_BATCH_NEON)
+
+static inline void loadColumns(const float *m, float32x4_t col[4]) {
+    col[0] = vld1q_f32(m);
+    col[1] = vld1q_f32(m + 4);
+    col[2] = vld1q_f32(m + 8);
+    col[3] = vld1q_f32(m + 12);
+}
+
+static inline float32x4_t combine(const float32x4_t col[4],
+                                  float32x4_t elem) {
+    float32x4_t sum = vmulq_lane_f32(col[0], vget_low_f32(elem), 0);
+    sum = vmlaq_lane_f32(sum, col[1], vget_low_f32(elem), 1);
+    sum = vmlaq_lane_f32(sum, col[2], vget_high_f32(elem), 0);
+    return vmlaq_lane_f32(sum, col[3], vget_high_f32(elem), 1);
+}
+
+// The elements of b are used from lanes, a column of b is one load
+static inline void storeProduct(const float32x4_t col[4],
+                                const float32x4_t other[4], float *out) {
+    vst1q_f32(out, combine(col, other[0]));
+    vst1q_f32(out + 4, combine(col, other[1]));
+    vst1q_f32(out + 8, combine(col, other[2]));
+    vst1q_f32(out + 12, combine(col, other[3]));
+}
+
+void multiplyBatch(const glm::mat4 &left, const glm::mat4 *right,
+                   size_t count, void *dst, size_t dstStride) {
+    float32x4_t col[4];
+    loadColumns(&left[0][0], col);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    for (size_t i = 0; i < count; i++, out += dstStride) {
+        float32x4_t other[4];
+        loadColumns(&right[i][0][0], other);
+        storeProduct(col, other, reinterpret_cast<float *>(out));
+    }
+}
+
+void multiplyBatch(const glm::mat4 *left, const glm::mat4 &right,
+                   size_t count, void *dst, size_t dstStride) {
+    float32x4_t other[4];
+    loadColumns(&right[0][0], other);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    for (size_t i = 0; i < count; i++, out += dstStride) {
+        float32x4_t col[4];
+        loadColumns(&left[i][0][0], col);
+        storeProduct(col, other, reinterpret_cast<float *>(out));
+    }
+}
+
+const char *getMatrixBatchPath() {
+    return "NEON";
+}
+
+#else
+
+static inline void storeProduct(const float *a, const float *b, void *dst) {
+    float out[16];
+    for (int j = 0; j < 4; j++) {
+        for (int r = 0; r < 4; r++) {
+            out[j * 4 + r] = a[r] * b[j * 4] + a[4 + r] * b[j * 4 + 1] +
+                             a[8 + r] * b[j * 4 + 2] + a[12 + r] * b[j * 4 + 3];
+        }
+    }
+    // dst may be unaligned mapped memory
+    memcpy(dst, out, sizeof(out));
+}
+
+void multiplyBatch(const glm::mat4 &left, const glm::mat4 *right,
+                   size_t count, void *dst, size_t dstStride) {
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    for (size_t i = 0; i < count; i++, out += dstStride) {
+        storeProduct(&left[0][0], &right[i][0][0], out);
+    }
+}
+
+void multiplyBatch(const glm::mat4 *left, const glm::mat4 &right,
+                   size_t count, void *dst, size_t dstStride) {
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    for (size_t i = 0; i < count; i++, out += dstStride) {
+        storeProduct(&left[i][0][0], &right[0][0], out);
+    }
+}
+
+const char *getMatrixBatchPath() {
+    return "scalar";
+}
+
+#endif
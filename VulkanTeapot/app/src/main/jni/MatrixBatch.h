@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_MATRIXBATCH_H
+#define VULKANTEAPOT_MATRIXBATCH_H
+
+#include <stddef.h>
+#include "glm/glm.hpp"
+
+/*
+ * Batched 4x4 products for object transforms. One side of the product is
+ * shared by the whole batch, so its columns or elements are loaded into
+ * registers once. Results are written with a stride, which lets them go
+ * straight to a mapped uniform buffer at minUniformBufferOffsetAlignment.
+ * dst does not need any alignment.
+ *
+ * Uses SSE2 on x86, NEON on ARM when the compiler targets it and plain C++
+ * otherwise.
+ */
+
+// dst[i] = left * right[i], e.g. view-projection times every model matrix
+void multiplyBatch(const glm::mat4 &left, const glm::mat4 *right,
+                   size_t count, void *dst, size_t dstStride);
+
+// dst[i] = left[i] * right, e.g. every object's cached view-projection
+// times the rotation shared by all objects
+void multiplyBatch(const glm::mat4 *left, const glm::mat4 &right,
+                   size_t count, void *dst, size_t dstStride);
+
+// Name of the code path compiled in, for logs and benchmarks
+const char *getMatrixBatchPath();
+
+#endif //VULKANTEAPOT_MATRIXBATCH_H
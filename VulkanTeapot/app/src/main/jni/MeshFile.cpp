@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#ifdef __ANDROID__
+#include <android/asset_manager.h>
+#include <android/log.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "MeshFile.h"
+
+static const char* kTAG = "MeshFile";
+#ifdef __ANDROID__
+#define LOGI(...) \
+  ((void)__android_log_print(ANDROID_LOG_INFO, kTAG, __VA_ARGS__))
+#define LOGE(...) \
+  ((void)__android_log_print(ANDROID_LOG_ERROR, kTAG, __VA_ARGS__))
+#else
+#define LOGI(...) \
+  ((void)(printf("%s: ", kTAG), printf(__VA_ARGS__), putchar('\n')))
+#define LOGE(...) \
+  ((void)(fprintf(stderr, "%s: ", kTAG), fprintf(stderr, __VA_ARGS__), \
+          fputc('\n', stderr)))
+#endif
+
+static const uint32_t kFormatSizes[MESH_FORMAT_NUM] = {
+        12,  // MESH_FORMAT_FLOAT32X3
+        8,   // MESH_FORMAT_SNORM16X4
+        4,   // MESH_FORMAT_UNORM10X3
+        4,   // MESH_FORMAT_OCT_SNORM16X2
+        8,   // MESH_FORMAT_FLOAT32X2
+        4,   // MESH_FORMAT_FLOAT16X2
+};
+
+static const uint32_t kSemanticFloatSizes[MESH_ATTRIBUTE_SEMANTIC_NUM] = {
+        12,  // MESH_ATTRIBUTE_POSITION
+        12,  // MESH_ATTRIBUTE_NORMAL
+        8,   // MESH_ATTRIBUTE_TEXCOORD
+        12,  // MESH_ATTRIBUTE_TANGENT
+        12,  // MESH_ATTRIBUTE_BINORMAL
+};
+
+static const uint32_t kUnitVectorFormats =
+        1u << MESH_FORMAT_FLOAT32X3 | 1u << MESH_FORMAT_UNORM10X3 |
+        1u << MESH_FORMAT_OCT_SNORM16X2;
+
+// Formats each semantic may be stored in, the shaders decode only these
+static const uint32_t kSemanticFormats[MESH_ATTRIBUTE_SEMANTIC_NUM] = {
+        1u << MESH_FORMAT_FLOAT32X3 | 1u << MESH_FORMAT_SNORM16X4,
+        kUnitVectorFormats,
+        1u << MESH_FORMAT_FLOAT32X2 | 1u << MESH_FORMAT_FLOAT16X2,
+        kUnitVectorFormats,
+        kUnitVectorFormats,
+};
+
+uint32_t getMeshFormatSize(uint32_t format) {
+    return format < MESH_FORMAT_NUM ? kFormatSizes[format] : 0;
+}
+
+bool isMeshFormatAllowed(uint32_t semantic, uint32_t format) {
+    return semantic < MESH_ATTRIBUTE_SEMANTIC_NUM && format < MESH_FORMAT_NUM &&
+           (kSemanticFormats[semantic] & 1u << format);
+}
+
+uint32_t getMeshSemanticFloatSize(uint32_t semantic) {
+    return semantic < MESH_ATTRIBUTE_SEMANTIC_NUM ?
+           kSemanticFloatSizes[semantic] : 0;
+}
+
+uint32_t getMeshFloatStride(const mesh_file_attribute *attributes,
+                            uint32_t count) {
+    uint32_t stride = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        stride += getMeshSemanticFloatSize(attributes[i].semantic);
+    }
+    return stride;
+}
+
+MeshFile::MeshFile()
+    : data(nullptr), size(0)
+{
+#ifdef __ANDROID__
+    asset = nullptr;
+#endif
+    memset(&header, 0, sizeof(header));
+}
+
+MeshFile::~MeshFile() {
+    close();
+}
+
+bool MeshFile::open(AAssetManager *assets, const char *path) {
+    close();
+#ifdef __ANDROID__
+    asset = AAssetManager_open(assets, path, AASSET_MODE_BUFFER);
+    if (!asset) {
+        LOGE("Cannot open %s", path);
+        return false;
+    }
+    data = (const uint8_t *)AAsset_getBuffer(asset);
+    size = AAsset_getLength(asset);
+    if (!data) {
+        LOGE("Cannot map %s", path);
+        close();
+        return false;
+    }
+    // Compressed assets are inflated into a heap copy, build.gradle keeps
+    // .mesh files stored
+    if (AAsset_isAllocated(asset)) {
+        LOGI("%s is compressed in the APK, loaded through a copy", path);
+    }
+#else
+    (void)assets;
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Cannot open %s", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        LOGE("Cannot stat %s", path);
+        ::close(fd);
+        return false;
+    }
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        LOGE("Cannot map %s", path);
+        return false;
+    }
+    data = (const uint8_t *)mapping;
+    size = st.st_size;
+#endif
+    if (!validate(path)) {
+        close();
+        return false;
+    }
+    LOGI("%s: %u vertices of %u bytes, %u indices", path, header.vertexCount,
+         header.vertexStride, header.indexCount);
+    // Every vertex is fetched at least once per draw, quantized attributes
+    // shrink that floor in proportion to the stride
+    uint32_t floatStride = getMeshFloatStride(attributes,
+                                              header.attributeCount);
+    if (floatStride) {
+        LOGI("%s: vertex fetch %zu bytes per draw, %zu as floats, "
+             "%.0f%% saved", path, getVertexBytes(),
+             (size_t)header.vertexCount * floatStride,
+             100.0 * (1.0 - (double)header.vertexStride / floatStride));
+    }
+    return true;
+}
+
+void MeshFile::close() {
+#ifdef __ANDROID__
+    if (asset) {
+        AAsset_close(asset);
+        asset = nullptr;
+    }
+#else
+    if (data) {
+        munmap((void *)data, size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+// The header and attributes are copied out, the buffer of an asset is
+// not guaranteed to be aligned for their 64 bit fields
+bool MeshFile::validate(const char *path) {
+    if (size < sizeof(header)) {
+        LOGE("%s is too small for a mesh", path);
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != MESH_FILE_MAGIC) {
+        LOGE("%s is not a mesh file", path);
+        return false;
+    }
+    if (header.version != MESH_FILE_VERSION) {
+        LOGE("%s has version %u, expected %u", path, header.version,
+             MESH_FILE_VERSION);
+        return false;
+    }
+    if (header.attributeCount > MESH_FILE_MAX_ATTRIBUTES ||
+        size < sizeof(header) +
+               header.attributeCount * sizeof(mesh_file_attribute)) {
+        LOGE("%s: bad attribute count %u", path, header.attributeCount);
+        return false;
+    }
+    memcpy(attributes, data + sizeof(header),
+           header.attributeCount * sizeof(mesh_file_attribute));
+    for (uint32_t i = 0; i < header.attributeCount; i++) {
+        uint32_t formatSize = getMeshFormatSize(attributes[i].format);
+        // Subtracting cannot wrap around the way offset + size could
+        if (!isMeshFormatAllowed(attributes[i].semantic,
+                                 attributes[i].format) ||
+            attributes[i].offset > header.vertexStride ||
+            formatSize > header.vertexStride - attributes[i].offset) {
+            LOGE("%s: bad attribute %u", path, i);
+            return false;
+        }
+    }
+    if (!header.vertexCount || !header.indexCount) {
+        LOGE("%s is empty", path);
+        return false;
+    }
+    if (header.indexSize != 2 && header.indexSize != 4) {
+        LOGE("%s: bad index size %u", path, header.indexSize);
+        return false;
+    }
+    // Sizes are computed in 64 bits, 32 bit counts cannot overflow them
+    uint64_t vertexBytes = (uint64_t)header.vertexCount * header.vertexStride;
+    uint64_t indexBytes = (uint64_t)header.indexCount * header.indexSize;
+    if (header.vertexOffset % MESH_FILE_ALIGNMENT ||
+        header.indexOffset % MESH_FILE_ALIGNMENT ||
+        header.vertexOffset > size || vertexBytes > size - header.vertexOffset ||
+        header.indexOffset > size || indexBytes > size - header.indexOffset) {
+        LOGE("%s: vertex or index data out of bounds", path);
+        return false;
+    }
+    // Load time processing indexes vertex arrays with these
+    std::vector<uint32_t> indices(header.indexCount);
+    decodeIndices(indices.data());
+    for (uint32_t i = 0; i < header.indexCount; i++) {
+        if (indices[i] >= header.vertexCount) {
+            LOGE("%s: index %u out of range", path, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+const mesh_file_header &MeshFile::getHeader() const {
+    return header;
+}
+
+const mesh_file_attribute *MeshFile::getAttribute(uint32_t semantic) const {
+    for (uint32_t i = 0; i < header.attributeCount; i++) {
+        if (attributes[i].semantic == semantic) {
+            return &attributes[i];
+        }
+    }
+    return nullptr;
+}
+
+const mesh_file_attribute *MeshFile::getAttributes() const {
+    return attributes;
+}
+
+const void *MeshFile::getVertices() const {
+    return data + header.vertexOffset;
+}
+
+const void *MeshFile::getIndices() const {
+    return data + header.indexOffset;
+}
+
+size_t MeshFile::getVertexBytes() const {
+    return (size_t)header.vertexCount * header.vertexStride;
+}
+
+size_t MeshFile::getIndexBytes() const {
+    return (size_t)header.indexCount * header.indexSize;
+}
+
+void MeshFile::decodeIndices(uint32_t *dst) const {
+    const uint8_t *src = data + header.indexOffset;
+    if (header.indexSize == 4) {
+        memcpy(dst, src, getIndexBytes());
+        return;
+    }
+    for (uint32_t i = 0; i < header.indexCount; i++) {
+        uint16_t index;
+        memcpy(&index, src + i * sizeof(index), sizeof(index));
+        dst[i] = index;
+    }
+}
+
+// Vertices are only 4 byte aligned, components are copied out
+void MeshFile::decodePositions(float *dst) const {
+    const mesh_file_attribute *position = getAttribute(MESH_ATTRIBUTE_POSITION);
+    if (!position) {
+        memset(dst, 0, (size_t)header.vertexCount * 3 * sizeof(float));
+        return;
+    }
+    const uint8_t *src = data + header.vertexOffset + position->offset;
+    for (uint32_t v = 0; v < header.vertexCount; v++) {
+        if (position->format == MESH_FORMAT_SNORM16X4) {
+            int16_t quantized[3];
+            memcpy(quantized, src, sizeof(quantized));
+            for (int c = 0; c < 3; c++) {
+                float value = quantized[c] / 32767.0f;
+                value = value < -1.0f ? -1.0f : value;
+                dst[c] = value * header.positionScale[c] +
+                         header.positionBias[c];
+            }
+        } else {
+            memcpy(dst, src, 3 * sizeof(float));
+        }
+        src += header.vertexStride;
+        dst += 3;
+    }
+}
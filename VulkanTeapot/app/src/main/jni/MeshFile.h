@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_MESHFILE_H
+#define VULKANTEAPOT_MESHFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary mesh container, written by tools/meshconv and mapped as is at
+ * load time. All fields are little-endian.
+ *
+ *   mesh_file_header
+ *   mesh_file_attribute[attributeCount]
+ *   vertices, vertexCount * vertexStride bytes, interleaved
+ *   indices, indexCount * indexSize bytes
+ *
+ * Vertex and index data start on MESH_FILE_ALIGNMENT byte boundaries so
+ * they can be handed to the upload path straight from the mapping.
+ * Readers reject other versions, bump MESH_FILE_VERSION whenever the
+ * layout changes.
+ *
+ * Attributes may be quantized to cut vertex fetch bandwidth, see
+ * MeshAttributeFormat. Quantized positions are decoded with the header's
+ * scale and bias, which the renderer folds into the model matrix.
+ */
+#define MESH_FILE_MAGIC 0x4853454du  /* "MESH" */
+#define MESH_FILE_VERSION 2
+#define MESH_FILE_ALIGNMENT 16
+#define MESH_FILE_MAX_ATTRIBUTES 8
+
+/* Triangles are in vertex cache and overdraw order, see MeshOptimizer.h */
+#define MESH_FILE_FLAG_TRIANGLES_OPTIMIZED (1u << 0)
+/* Vertices are welded, in fetch order and all used */
+#define MESH_FILE_FLAG_VERTICES_COMPACTED (1u << 1)
+
+/* What an attribute holds, selects the vertex shader input */
+enum MeshAttributeSemantic {
+    MESH_ATTRIBUTE_POSITION,
+    MESH_ATTRIBUTE_NORMAL,
+    MESH_ATTRIBUTE_TEXCOORD,
+    MESH_ATTRIBUTE_TANGENT,
+    MESH_ATTRIBUTE_BINORMAL,
+    MESH_ATTRIBUTE_SEMANTIC_NUM
+};
+
+/*
+ * How an attribute is stored, mapped to a VkFormat by the renderer. Every
+ * format is one the Vulkan spec requires for vertex buffers.
+ */
+enum MeshAttributeFormat {
+    MESH_FORMAT_FLOAT32X3,
+    // Positions, xyz scaled into [-1, 1] by positionScale/positionBias,
+    // w is 1
+    MESH_FORMAT_SNORM16X4,
+    // Unit vectors, xyz * 0.5 + 0.5 in the low 30 bits, A2B10G10R10 order
+    MESH_FORMAT_UNORM10X3,
+    // Unit vectors, octahedral projection onto the xy plane
+    MESH_FORMAT_OCT_SNORM16X2,
+    MESH_FORMAT_FLOAT32X2,
+    MESH_FORMAT_FLOAT16X2,
+    MESH_FORMAT_NUM
+};
+
+typedef struct _mesh_file_attribute {
+    uint32_t semantic;
+    uint32_t format;
+    // From the start of the vertex
+    uint32_t offset;
+    uint32_t reserved;
+} mesh_file_attribute;
+
+typedef struct _mesh_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t attributeCount;
+    uint32_t vertexStride;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    // 2 or 4 bytes
+    uint32_t indexSize;
+    // MESH_FILE_FLAG_*
+    uint32_t flags;
+    // Object space bounding box of the positions
+    float boundsMin[3];
+    float boundsMax[3];
+    // Object space position = stored position * scale + bias, identity
+    // for float positions
+    float positionScale[3];
+    float positionBias[3];
+    // From the start of the file
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+} mesh_file_header;
+
+/* Bytes per element of an attribute format */
+uint32_t getMeshFormatSize(uint32_t format);
+/* Bytes an attribute takes as plain floats, the baseline for bandwidth */
+uint32_t getMeshSemanticFloatSize(uint32_t semantic);
+/* Whether the shaders can decode a semantic stored in a format */
+bool isMeshFormatAllowed(uint32_t semantic, uint32_t format);
+/* Sum of the float sizes of the attributes in a vertex */
+uint32_t getMeshFloatStride(const mesh_file_attribute *attributes,
+                            uint32_t count);
+
+struct AAssetManager;
+struct AAsset;
+
+/*
+ * A mesh file mapped into memory. On Android it is read from the APK
+ * through AAsset_getBuffer, which maps uncompressed assets directly;
+ * elsewhere the file is mmap()ed. Nothing is copied, vertex and index
+ * pointers stay valid until close().
+ */
+class MeshFile {
+public:
+    MeshFile();
+    ~MeshFile();
+
+    // assets is only used on Android, path is relative to the asset root
+    // there and to the working directory elsewhere. Validates the header
+    // and every range against the file size.
+    bool open(AAssetManager *assets, const char *path);
+    void close();
+
+    const mesh_file_header &getHeader() const;
+    const mesh_file_attribute *getAttribute(uint32_t semantic) const;
+    // getHeader().attributeCount of them
+    const mesh_file_attribute *getAttributes() const;
+    const void *getVertices() const;
+    const void *getIndices() const;
+    size_t getVertexBytes() const;
+    size_t getIndexBytes() const;
+    // Object space positions as 3 floats per vertex, quantized ones are
+    // decoded. For load time processing, the renderer draws the stored
+    // format.
+    void decodePositions(float *dst) const;
+    // Indices widened to 32 bits
+    void decodeIndices(uint32_t *dst) const;
+
+private:
+    mesh_file_header header;
+    mesh_file_attribute attributes[MESH_FILE_MAX_ATTRIBUTES];
+    const uint8_t *data;
+    size_t size;
+#ifdef __ANDROID__
+    AAsset *asset;
+#endif
+
+    bool validate(const char *path);
+};
+
+#endif //VULKANTEAPOT_MESHFILE_H
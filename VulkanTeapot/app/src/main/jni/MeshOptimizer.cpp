@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "MeshOptimizer.h"
+
+vertex_cache_stats analyzeVertexCache(const uint32_t *indices,
+                                      size_t indexCount, size_t vertexCount,
+                                      uint32_t cacheSize) {
+    // A vertex is still cached while fewer than cacheSize misses happened
+    // since it was loaded
+    std::vector<uint32_t> loadedAt(vertexCount, 0);
+    uint32_t misses = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t v = indices[i];
+        if (!loadedAt[v] || misses + 1 - loadedAt[v] > cacheSize) {
+            misses++;
+            loadedAt[v] = misses;
+        }
+    }
+    vertex_cache_stats stats;
+    stats.acmr = indexCount ? misses / (indexCount / 3.0f) : 0.0f;
+    stats.atvr = vertexCount ? misses / (float)vertexCount : 0.0f;
+    return stats;
+}
+
+/*
+ * Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality
+ * and Reduced Overdraw" (Tipsify). Emits all remaining triangles around a
+ * fanning vertex, then moves on to the vertex of that fan that is still
+ * cached and has the most triangles that would fit while it stays cached.
+ * Dead ends fall back to recently used vertices, then to input order.
+ * Unlike score based methods it models the FIFO of the target directly.
+ */
+void optimizeVertexCache(uint32_t *dst, const uint32_t *indices,
+                         size_t indexCount, size_t vertexCount,
+                         uint32_t cacheSize) {
+    size_t triangleCount = indexCount / 3;
+    if (!triangleCount) {
+        return;
+    }
+    std::vector<uint32_t> source(indices, indices + triangleCount * 3);
+
+    // Triangles of each vertex, packed
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (size_t i = 0; i < source.size(); i++) {
+        live[source[i]]++;
+    }
+    std::vector<uint32_t> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) {
+        firstTriangle[v + 1] = firstTriangle[v] + live[v];
+    }
+    std::vector<uint32_t> adjacency(source.size());
+    std::vector<uint32_t> filled(vertexCount, 0);
+    for (size_t i = 0; i < source.size(); i++) {
+        uint32_t v = source[i];
+        adjacency[firstTriangle[v] + filled[v]++] = (uint32_t)(i / 3);
+    }
+
+    // A vertex is cached while time - cachedAt[v] <= cacheSize, time
+    // starts past cacheSize so nothing is cached at first
+    std::vector<uint32_t> cachedAt(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    size_t cursor = 0;
+    size_t out = 0;
+    int64_t fan = source[0];
+    while (fan >= 0) {
+        candidates.clear();
+        for (uint32_t j = firstTriangle[fan]; j < firstTriangle[fan + 1];
+             j++) {
+            uint32_t t = adjacency[j];
+            if (emitted[t]) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = source[t * 3 + k];
+                dst[out++] = v;
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cachedAt[v] > cacheSize) {
+                    cachedAt[v] = time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        // The next fan is the candidate cached longest that will still be
+        // cached after emitting its fan, each triangle adds at most two
+        // vertices
+        fan = -1;
+        int64_t bestPriority = -1;
+        for (size_t i = 0; i < candidates.size(); i++) {
+            uint32_t v = candidates[i];
+            if (!live[v]) {
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cachedAt[v] + 2 * live[v] <= cacheSize) {
+                priority = time - cachedAt[v];
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                fan = v;
+            }
+        }
+        while (fan < 0 && !deadEnds.empty()) {
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[v]) {
+                fan = v;
+            }
+        }
+        while (fan < 0 && cursor < vertexCount) {
+            if (live[cursor]) {
+                fan = cursor;
+            }
+            cursor++;
+        }
+    }
+}
+
+namespace {
+
+struct overdraw_cluster {
+    size_t start;
+    size_t end;
+    float sortKey;
+};
+
+bool drawsFirst(const overdraw_cluster &a, const overdraw_cluster &b) {
+    return a.sortKey > b.sortKey;
+}
+
+}
+
+// Second half of the same paper, clusters are cut where the cache order
+// has paid off its startup misses so moving them costs little reuse
+void optimizeOverdraw(uint32_t *dst, const uint32_t *indices,
+                      size_t indexCount, const float *positions,
+                      size_t vertexCount, float threshold) {
+    size_t triangleCount = indexCount / 3;
+    if (!triangleCount) {
+        return;
+    }
+    std::vector<uint32_t> source(indices, indices + triangleCount * 3);
+
+    float targetAcmr = threshold * analyzeVertexCache(
+            &source[0], source.size(), vertexCount,
+            VERTEX_CACHE_REPORT_SIZE).acmr;
+
+    // Clusters end up next to arbitrary others, so each is simulated from
+    // a cold cache. A cluster closes as soon as it has paid off its startup
+    // misses, the reordered mesh then stays within threshold of the input.
+    std::vector<overdraw_cluster> clusters;
+    overdraw_cluster cluster = {};
+    std::vector<uint32_t> loadedAt(vertexCount, 0);
+    uint32_t misses = 0;
+    uint32_t clusterStartMisses = 0;
+    for (size_t t = 0; t < triangleCount; t++) {
+        if (t > cluster.start && misses - clusterStartMisses <=
+                                 targetAcmr * (t - cluster.start)) {
+            cluster.end = t;
+            clusters.push_back(cluster);
+            cluster.start = t;
+            // Pushing the miss count past every load time empties the
+            // cache without touching loadedAt
+            misses += VERTEX_CACHE_REPORT_SIZE;
+            clusterStartMisses = misses;
+        }
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = source[t * 3 + k];
+            if (!loadedAt[v] ||
+                misses + 1 - loadedAt[v] > VERTEX_CACHE_REPORT_SIZE) {
+                misses++;
+                loadedAt[v] = misses;
+            }
+        }
+    }
+    cluster.end = triangleCount;
+    clusters.push_back(cluster);
+
+    // Area weighted centroids and normals, cross products are twice the
+    // area so the weights cancel out
+    float meshCenter[3] = {};
+    float meshArea = 0.0f;
+    std::vector<float> clusterData(clusters.size() * 6, 0.0f);
+    for (size_t c = 0; c < clusters.size(); c++) {
+        float *center = &clusterData[c * 6];
+        float *normal = center + 3;
+        float area = 0.0f;
+        for (size_t t = clusters[c].start; t < clusters[c].end; t++) {
+            const float *p0 = &positions[source[t * 3] * 3];
+            const float *p1 = &positions[source[t * 3 + 1] * 3];
+            const float *p2 = &positions[source[t * 3 + 2] * 3];
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                           e1[2] * e2[0] - e1[0] * e2[2],
+                           e1[0] * e2[1] - e1[1] * e2[0] };
+            float weight = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; k++) {
+                center[k] += (p0[k] + p1[k] + p2[k]) * weight / 3.0f;
+                normal[k] += n[k];
+            }
+            area += weight;
+        }
+        for (int k = 0; k < 3; k++) {
+            meshCenter[k] += center[k];
+            center[k] = area > 0.0f ? center[k] / area : 0.0f;
+        }
+        meshArea += area;
+    }
+    for (int k = 0; k < 3; k++) {
+        meshCenter[k] = meshArea > 0.0f ? meshCenter[k] / meshArea : 0.0f;
+    }
+    for (size_t c = 0; c < clusters.size(); c++) {
+        const float *center = &clusterData[c * 6];
+        const float *normal = center + 3;
+        float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] +
+                             normal[2] * normal[2]);
+        float key = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            key += (center[k] - meshCenter[k]) * normal[k];
+        }
+        clusters[c].sortKey = length > 0.0f ? key / length : 0.0f;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), drawsFirst);
+    size_t out = 0;
+    for (size_t c = 0; c < clusters.size(); c++) {
+        size_t count = (clusters[c].end - clusters[c].start) * 3;
+        memcpy(&dst[out], &source[clusters[c].start * 3],
+               count * sizeof(uint32_t));
+        out += count;
+    }
+}
+
+void optimizeTriangleOrder(uint32_t *indices, size_t indexCount,
+                           const float *positions, size_t vertexCount,
+                           vertex_cache_stats *before,
+                           vertex_cache_stats *after) {
+    *before = analyzeVertexCache(indices, indexCount, vertexCount,
+                                 VERTEX_CACHE_REPORT_SIZE);
+    std::vector<uint32_t> reordered(indexCount);
+    optimizeVertexCache(reordered.data(), indices, indexCount, vertexCount,
+                        VERTEX_CACHE_REPORT_SIZE);
+    vertex_cache_stats stats = analyzeVertexCache(
+            reordered.data(), indexCount, vertexCount,
+            VERTEX_CACHE_REPORT_SIZE);
+    if (stats.acmr < before->acmr) {
+        memcpy(indices, reordered.data(), indexCount * sizeof(uint32_t));
+    }
+    optimizeOverdraw(indices, indices, indexCount, positions, vertexCount,
+                     1.05f);
+    *after = analyzeVertexCache(indices, indexCount, vertexCount,
+                                VERTEX_CACHE_REPORT_SIZE);
+}
+
+// FNV-1a over the whole vertex
+static uint32_t hashVertex(const uint8_t *vertex, size_t stride) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < stride; i++) {
+        hash = (hash ^ vertex[i]) * 16777619u;
+    }
+    return hash;
+}
+
+size_t generateVertexRemap(uint32_t *remap, const uint32_t *indices,
+                           size_t indexCount, const void *vertices,
+                           size_t vertexCount, size_t stride) {
+    std::fill(remap, remap + vertexCount, VERTEX_REMAP_UNUSED);
+    const uint8_t *bytes = (const uint8_t *)vertices;
+
+    // Open addressing over the first vertex of every weld group, at most
+    // half full
+    size_t tableSize = 1;
+    while (tableSize < vertexCount * 2) {
+        tableSize *= 2;
+    }
+    std::vector<uint32_t> table(bytes ? tableSize : 0, VERTEX_REMAP_UNUSED);
+
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t v = indices[i];
+        if (remap[v] != VERTEX_REMAP_UNUSED) {
+            continue;
+        }
+        if (!bytes) {
+            remap[v] = next++;
+            continue;
+        }
+        const uint8_t *vertex = bytes + v * stride;
+        size_t slot = hashVertex(vertex, stride) & (tableSize - 1);
+        while (table[slot] != VERTEX_REMAP_UNUSED &&
+               memcmp(bytes + table[slot] * stride, vertex, stride)) {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        if (table[slot] == VERTEX_REMAP_UNUSED) {
+            table[slot] = v;
+            remap[v] = next++;
+        } else {
+            remap[v] = remap[table[slot]];
+        }
+    }
+    return next;
+}
+
+void remapIndexBuffer(uint32_t *dst, const uint32_t *indices,
+                      size_t indexCount, const uint32_t *remap) {
+    for (size_t i = 0; i < indexCount; i++) {
+        dst[i] = remap[indices[i]];
+    }
+}
+
+// Welded vertices all land on the same slot with the same bytes
+void remapVertexBuffer(void *dst, const void *vertices, size_t vertexCount,
+                       size_t stride, const uint32_t *remap) {
+    for (size_t v = 0; v < vertexCount; v++) {
+        if (remap[v] != VERTEX_REMAP_UNUSED) {
+            memcpy((uint8_t *)dst + remap[v] * stride,
+                   (const uint8_t *)vertices + v * stride, stride);
+        }
+    }
+}
+
+static bool samePosition(const float *positions, uint32_t a, uint32_t b) {
+    return !memcmp(&positions[a * 3], &positions[b * 3], 3 * sizeof(float));
+}
+
+size_t removeDegenerateTriangles(uint32_t *indices, size_t indexCount,
+                                 const float *positions) {
+    size_t out = 0;
+    for (size_t i = 0; i + 2 < indexCount; i += 3) {
+        uint32_t a = indices[i];
+        uint32_t b = indices[i + 1];
+        uint32_t c = indices[i + 2];
+        if (a == b || b == c || c == a) {
+            continue;
+        }
+        if (positions && (samePosition(positions, a, b) ||
+                          samePosition(positions, b, c) ||
+                          samePosition(positions, c, a))) {
+            continue;
+        }
+        indices[out++] = a;
+        indices[out++] = b;
+        indices[out++] = c;
+    }
+    return out;
+}
+
+// Applies remap to the vertex stream and the positions through a scratch
+// copy, the remapped data never needs more room than the original
+static void remapVertices(void *vertices, size_t stride, size_t vertexCount,
+                          float *positions, const uint32_t *remap) {
+    size_t bytes = vertexCount * stride;
+    std::vector<uint8_t> scratch((const uint8_t *)vertices,
+                                 (const uint8_t *)vertices + bytes);
+    remapVertexBuffer(vertices, scratch.data(), vertexCount, stride, remap);
+    std::vector<float> scratchPositions(positions,
+                                        positions + vertexCount * 3);
+    remapVertexBuffer(positions, scratchPositions.data(), vertexCount,
+                      3 * sizeof(float), remap);
+}
+
+void optimizeMesh(void *vertices, size_t stride, size_t *vertexCount,
+                  uint32_t *indices, size_t *indexCount, float *positions,
+                  bool reorderTriangles, mesh_optimize_stats *stats) {
+    stats->vertexCountBefore = *vertexCount;
+    stats->triangleCountBefore = *indexCount / 3;
+    stats->cacheBefore = analyzeVertexCache(indices, *indexCount,
+                                            *vertexCount,
+                                            VERTEX_CACHE_REPORT_SIZE);
+    std::vector<uint32_t> remap(*vertexCount);
+
+    size_t count = generateVertexRemap(remap.data(), indices, *indexCount,
+                                       vertices, *vertexCount, stride);
+    remapIndexBuffer(indices, indices, *indexCount, remap.data());
+    remapVertices(vertices, stride, *vertexCount, positions, remap.data());
+    *indexCount = removeDegenerateTriangles(indices, *indexCount, positions);
+
+    if (reorderTriangles) {
+        vertex_cache_stats before, after;
+        optimizeTriangleOrder(indices, *indexCount, positions, count,
+                              &before, &after);
+    }
+
+    // Degenerate triangles may have held the only use of a vertex, the
+    // count can still drop here
+    size_t fetchCount = generateVertexRemap(remap.data(), indices,
+                                            *indexCount, nullptr, count,
+                                            stride);
+    remapIndexBuffer(indices, indices, *indexCount, remap.data());
+    remapVertices(vertices, stride, count, positions, remap.data());
+
+    *vertexCount = fetchCount;
+    stats->vertexCountAfter = fetchCount;
+    stats->triangleCountAfter = *indexCount / 3;
+    stats->cacheAfter = analyzeVertexCache(indices, *indexCount, fetchCount,
+                                           VERTEX_CACHE_REPORT_SIZE);
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_MESHOPTIMIZER_H
+#define VULKANTEAPOT_MESHOPTIMIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Optimization passes for indexed triangle lists. Triangle reordering only
+ * changes the order of the triangles, each keeps its vertices and winding.
+ * Vertex passes work on the interleaved stream as stored, in whatever
+ * formats it holds, and only drop exact duplicates and triangles that
+ * cover no pixels. Either way the result renders identically, with fewer
+ * vertex shader invocations and fewer bytes fetched.
+ *
+ * Shared by tools/meshconv, which optimizes offline, and by the renderer,
+ * which optimizes meshes at load time that were written without it.
+ */
+
+/* FIFO size used for the reported statistics, close to mobile GPUs */
+#define VERTEX_CACHE_REPORT_SIZE 16
+
+/* Remap entry of a vertex no triangle uses */
+#define VERTEX_REMAP_UNUSED 0xffffffffu
+
+typedef struct _vertex_cache_stats {
+    // Average cache miss ratio, vertex shader runs per triangle. 0.5 is
+    // the floor for large regular meshes, 3 means no reuse at all.
+    float acmr;
+    // Average transformed vertex ratio, vertex shader runs per vertex.
+    // 1 is optimal.
+    float atvr;
+} vertex_cache_stats;
+
+// Simulates a FIFO post-transform cache of cacheSize entries
+vertex_cache_stats analyzeVertexCache(const uint32_t *indices,
+                                      size_t indexCount, size_t vertexCount,
+                                      uint32_t cacheSize);
+
+// Tipsify reordering for a FIFO of cacheSize entries. dst may be indices.
+void optimizeVertexCache(uint32_t *dst, const uint32_t *indices,
+                         size_t indexCount, size_t vertexCount,
+                         uint32_t cacheSize);
+
+// Splits a cache optimized order into clusters and draws the ones pointing
+// most outward from the mesh center first, they are the likeliest to hide
+// the rest from any viewpoint. Clusters close once their ACMR is within
+// threshold of the whole mesh's, 1.05 keeps the cache efficiency within
+// about 5%. positions holds 3 floats per vertex. dst may be indices.
+void optimizeOverdraw(uint32_t *dst, const uint32_t *indices,
+                      size_t indexCount, const float *positions,
+                      size_t vertexCount, float threshold);
+
+// Renumbers vertices in the order the index buffer first uses them, which
+// turns vertex fetch into a mostly sequential walk. With vertices given,
+// vertices whose stride bytes are identical are welded into one number;
+// vertices may be null to only renumber. Returns the new vertex count.
+size_t generateVertexRemap(uint32_t *remap, const uint32_t *indices,
+                           size_t indexCount, const void *vertices,
+                           size_t vertexCount, size_t stride);
+
+// dst may be indices
+void remapIndexBuffer(uint32_t *dst, const uint32_t *indices,
+                      size_t indexCount, const uint32_t *remap);
+
+// dst must not overlap vertices, unused vertices are left out
+void remapVertexBuffer(void *dst, const void *vertices, size_t vertexCount,
+                       size_t stride, const uint32_t *remap);
+
+// Drops triangles that repeat an index, or with positions given, repeat a
+// position. Order is kept. Returns the new index count.
+size_t removeDegenerateTriangles(uint32_t *indices, size_t indexCount,
+                                 const float *positions);
+
+// Both passes in place at VERTEX_CACHE_REPORT_SIZE and a 1.05 overdraw
+// threshold. The cache pass is skipped when the input order already does
+// better, authored meshes sometimes come in optimal order.
+void optimizeTriangleOrder(uint32_t *indices, size_t indexCount,
+                           const float *positions, size_t vertexCount,
+                           vertex_cache_stats *before,
+                           vertex_cache_stats *after);
+
+typedef struct _mesh_optimize_stats {
+    size_t vertexCountBefore;
+    size_t vertexCountAfter;
+    size_t triangleCountBefore;
+    size_t triangleCountAfter;
+    vertex_cache_stats cacheBefore;
+    vertex_cache_stats cacheAfter;
+} mesh_optimize_stats;
+
+// Every pass in order, in place: weld, remove degenerate triangles,
+// reorder triangles when reorderTriangles is set, then renumber vertices
+// for fetch. positions holds 3 floats per vertex and follows the remaps.
+// vertexCount and indexCount are updated, the arrays are not shrunk.
+void optimizeMesh(void *vertices, size_t stride, size_t *vertexCount,
+                  uint32_t *indices, size_t *indexCount, float *positions,
+                  bool reorderTriangles, mesh_optimize_stats *stats);
+
+#endif //VULKANTEAPOT_MESHOPTIMIZER_H
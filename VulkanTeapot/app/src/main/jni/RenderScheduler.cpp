@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+#include <android/log.h>
+#include "RenderScheduler.h"
+
+static const char* kTAG = "RenderScheduler";
+#define LOGI(...) \
+  ((void)__android_log_print(ANDROID_LOG_INFO, kTAG, __VA_ARGS__))
+
+/* Interval of the wakeup and sleep statistics, in milliseconds */
+#define STATS_INTERVAL 1000.0
+
+/* Weight of a new sample in the running average of the frame interval */
+#define FRAME_INTERVAL_WEIGHT 0.1
+
+static double getTimeMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+RenderScheduler::RenderScheduler()
+    : dirty(true), animating(false), frameInterval(0.0), lastFrameTime(0.0),
+      sleptSinceFrame(true), wakeups(0), frames(0), sleepStart(0.0),
+      sleepTime(0.0), skipped(0.0)
+{
+    intervalStart = getTimeMs();
+}
+
+void RenderScheduler::requestRedraw() {
+    dirty = true;
+}
+
+void RenderScheduler::setAnimating(bool animating) {
+    this->animating = animating;
+}
+
+bool RenderScheduler::needsRedraw() {
+    return dirty || animating;
+}
+
+void RenderScheduler::onSleep() {
+    sleepStart = getTimeMs();
+}
+
+void RenderScheduler::onWakeup() {
+    double now = getTimeMs();
+    double slept = now - sleepStart;
+    sleepTime += slept;
+    if (frameInterval > 0.0) {
+        skipped += slept / frameInterval;
+    }
+    sleptSinceFrame = true;
+    wakeups++;
+    updateStats(now);
+}
+
+void RenderScheduler::onFrameRendered() {
+    double now = getTimeMs();
+    // Back to back frames are paced by present, that is the rate the old
+    // busy loop rendered at
+    if (!sleptSinceFrame) {
+        double interval = now - lastFrameTime;
+        frameInterval = frameInterval > 0.0 ?
+                frameInterval + (interval - frameInterval) *
+                                FRAME_INTERVAL_WEIGHT : interval;
+    }
+    lastFrameTime = now;
+    sleptSinceFrame = false;
+
+    frames++;
+    dirty = false;
+    updateStats(now);
+}
+
+void RenderScheduler::updateStats(double now) {
+    double elapsed = now - intervalStart;
+    if (elapsed < STATS_INTERVAL) {
+        return;
+    }
+
+    // The interval can be much longer than a second after an idle period.
+    // Skipped frames stay 0 until two frames ran back to back.
+    LOGI("%.1f s: %u wakeups (%.1f/s), %u frames rendered, asleep %.0f%%, "
+         "%u frames skipped at %.2f ms/frame", elapsed / 1000.0, wakeups,
+         wakeups * 1000.0 / elapsed, frames, 100.0 * sleepTime / elapsed,
+         (uint32_t)skipped, frameInterval);
+
+    wakeups = 0;
+    frames = 0;
+    sleepTime = 0.0;
+    skipped = 0.0;
+    intervalStart = now;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_RENDERSCHEDULER_H
+#define VULKANTEAPOT_RENDERSCHEDULER_H
+
+#include <stdint.h>
+
+/*
+ * Decides when the render loop has to render. The scene only changes on
+ * input or while an animation runs, so instead of drawing continuously the
+ * loop sleeps until something marks the scene dirty. Wakeups, frames
+ * rendered, the share of time spent asleep and the frames skipped are
+ * logged once per second while the loop is awake. Skipped frames are the
+ * ones a continuous loop would have rendered while we slept, at the frame
+ * interval measured whenever frames follow each other without a sleep.
+ */
+class RenderScheduler {
+public:
+    RenderScheduler();
+
+    // The scene changed, render one more frame
+    void requestRedraw();
+    // Keep rendering every frame while an animation is running
+    void setAnimating(bool animating);
+    bool needsRedraw();
+
+    // Around the wait for the next message
+    void onSleep();
+    void onWakeup();
+    void onFrameRendered();
+
+private:
+    bool dirty;
+    bool animating;
+
+    // Continuous frame interval in milliseconds, 0 until measured
+    double frameInterval;
+    double lastFrameTime;
+    bool sleptSinceFrame;
+
+    // Counters of the current reporting interval
+    uint32_t wakeups;
+    uint32_t frames;
+    double intervalStart;
+    double sleepStart;
+    double sleepTime;
+    double skipped;
+
+    void updateStats(double now);
+};
+
+#endif //VULKANTEAPOT_RENDERSCHEDULER_H
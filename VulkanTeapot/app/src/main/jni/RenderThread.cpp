@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android/log.h>
+#include <android_native_app_glue.h>
+#include "RenderThread.h"
+#include "VulkanMain.hpp"
+
+static const char* kTAG = "RenderThread";
+#define LOGI(...) \
+  ((void)__android_log_print(ANDROID_LOG_INFO, kTAG, __VA_ARGS__))
+
+RenderThread::RenderThread(android_app *app)
+    : app(app), running(false), sleeping(false),
+      postedSerial(0), handledSerial(0)
+{
+}
+
+RenderThread::~RenderThread() {
+    stop();
+}
+
+void RenderThread::start() {
+    if (running) {
+        return;
+    }
+    running = true;
+    thread = std::thread(&RenderThread::run, this);
+}
+
+void RenderThread::stop() {
+    if (!running) {
+        return;
+    }
+    render_message msg = {};
+    msg.type = RENDER_MSG_QUIT;
+    post(msg);
+    thread.join();
+    running = false;
+}
+
+void RenderThread::post(const render_message &msg) {
+    // The queue only fills up if the render thread is stuck, lifecycle
+    // commands must not be dropped so wait for room
+    while (!queue.push(msg)) {
+        std::this_thread::yield();
+    }
+
+    // Pairs with the fence in waitForMessage(): either the render thread
+    // sees the message before sleeping or we see that it sleeps
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wakeCond.notify_one();
+    }
+}
+
+void RenderThread::postAndWait(render_message msg) {
+    std::unique_lock<std::mutex> lock(ackMutex);
+    msg.serial = ++postedSerial;
+    post(msg);
+    ackCond.wait(lock, [this, &msg] { return handledSerial >= msg.serial; });
+}
+
+void RenderThread::waitForMessage() {
+    scheduler.onSleep();
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wakeCond.wait(lock, [this] { return !queue.empty(); });
+    sleeping.store(false, std::memory_order_relaxed);
+    scheduler.onWakeup();
+}
+
+void RenderThread::run() {
+    LOGI("render thread started");
+
+    bool quit = false;
+    while (!quit) {
+        render_message msg;
+        while (queue.pop(msg)) {
+            handleMessage(msg);
+            if (msg.type == RENDER_MSG_QUIT) {
+                quit = true;
+                break;
+            }
+        }
+        if (quit) {
+            break;
+        }
+
+        // While there is something to show the loop is paced by present,
+        // otherwise it sleeps until the next message arrives
+        if (IsVulkanReady() && scheduler.needsRedraw()) {
+            VkResult res = VulkanDrawFrame();
+            // Out of date means nothing was presented. Either way a
+            // recreated swapchain has not shown the scene yet.
+            if (res != VK_ERROR_OUT_OF_DATE_KHR) {
+                scheduler.onFrameRendered();
+            }
+            if (res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR) {
+                scheduler.requestRedraw();
+            }
+        } else {
+            waitForMessage();
+        }
+    }
+
+    LOGI("render thread exiting");
+}
+
+void RenderThread::handleMessage(const render_message &msg) {
+    switch (msg.type) {
+        case RENDER_MSG_WINDOW_INIT:
+            InitVulkan(app, msg.window);
+            scheduler.requestRedraw();
+            break;
+        case RENDER_MSG_WINDOW_TERM:
+            VulkanReleaseSurface();
+            break;
+        case RENDER_MSG_WINDOW_RESIZED:
+            VulkanOnWindowResized();
+            scheduler.requestRedraw();
+            break;
+        case RENDER_MSG_DRAG:
+            VulkanOnDrag(msg.x, msg.y);
+            scheduler.requestRedraw();
+            break;
+        case RENDER_MSG_SWAPCHAIN_POLICY:
+            VulkanSetSwapchainPolicy((SwapchainPolicy)msg.value);
+            scheduler.requestRedraw();
+            break;
+        case RENDER_MSG_QUIT:
+            DeleteVulkan();
+            break;
+    }
+
+    if (msg.serial != 0) {
+        {
+            std::lock_guard<std::mutex> lock(ackMutex);
+            handledSerial = msg.serial;
+        }
+        ackCond.notify_all();
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_RENDERTHREAD_H
+#define VULKANTEAPOT_RENDERTHREAD_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "SpscQueue.h"
+#include "RenderScheduler.h"
+
+struct android_app;
+struct ANativeWindow;
+
+enum RenderMessageType {
+    RENDER_MSG_WINDOW_INIT,       // window: the new native window
+    RENDER_MSG_WINDOW_TERM,       // the window is about to be destroyed
+    RENDER_MSG_WINDOW_RESIZED,
+    RENDER_MSG_DRAG,              // x, y: drag distance from touch down
+    RENDER_MSG_SWAPCHAIN_POLICY,  // value: SwapchainPolicy
+    RENDER_MSG_QUIT,
+};
+
+typedef struct _render_message {
+    RenderMessageType type;
+    ANativeWindow *window;
+    float x;
+    float y;
+    int32_t value;
+    // Non zero when the sender waits until the message has been handled
+    uint32_t serial;
+} render_message;
+
+/*
+ * Owns the Vulkan device and renders on its own thread. The ALooper thread
+ * only forwards input and lifecycle commands through a lock-free queue, so
+ * slow event processing cannot delay a frame and a frame blocked on
+ * present cannot delay event processing.
+ */
+class RenderThread {
+public:
+    RenderThread(android_app *app);
+    ~RenderThread();
+
+    void start();
+    // Asks the thread to delete the device and waits for it to exit
+    void stop();
+
+    // Called from the ALooper thread only
+    void post(const render_message &msg);
+    // Returns once the render thread has handled the message. Used for the
+    // window hand-off, the window must not go away while it is in use.
+    void postAndWait(render_message msg);
+
+private:
+    android_app *app;
+    std::thread thread;
+    bool running;
+
+    SpscQueue<render_message, 256> queue;
+
+    // Lets the thread sleep while there is nothing to render
+    std::mutex wakeMutex;
+    std::condition_variable wakeCond;
+    std::atomic<bool> sleeping;
+
+    // Acknowledgement of messages posted with postAndWait()
+    std::mutex ackMutex;
+    std::condition_variable ackCond;
+    uint32_t postedSerial;
+    uint32_t handledSerial;
+
+    // Only touched by the render thread
+    RenderScheduler scheduler;
+
+    void run();
+    void handleMessage(const render_message &msg);
+    void waitForMessage();
+};
+
+#endif //VULKANTEAPOT_RENDERTHREAD_H
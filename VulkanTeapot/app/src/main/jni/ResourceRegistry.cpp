@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstring>
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+#include "ResourceRegistry.h"
+
+static const char* kTAG = "ResourceRegistry";
+#ifdef __ANDROID__
+#define LOGI(...) \
+  ((void)__android_log_print(ANDROID_LOG_INFO, kTAG, __VA_ARGS__))
+#define LOGE(...) \
+  ((void)__android_log_print(ANDROID_LOG_ERROR, kTAG, __VA_ARGS__))
+#else
+#define LOGI(...) \
+  ((void)(printf("%s: ", kTAG), printf(__VA_ARGS__), putchar('\n')))
+#define LOGE(...) \
+  ((void)(fprintf(stderr, "%s: ", kTAG), fprintf(stderr, __VA_ARGS__), \
+          fputc('\n', stderr)))
+#endif
+
+static const double kMiB = 1024.0 * 1024.0;
+
+static const char *kTypeNames[RESOURCE_TYPE_NUM] = {
+        "device memory", "buffer", "image", "image view", "framebuffer",
+        "render pass", "shader module", "pipeline cache", "pipeline layout",
+        "pipeline", "descriptor set layout", "descriptor pool",
+        "command pool", "command buffer", "fence", "semaphore", "swapchain",
+        "surface",
+};
+
+ResourceRegistry::ResourceRegistry()
+    : lazyBytes(0), peakDeviceMemoryBytes(0), created(0), destroyed(0)
+{
+    memset(count, 0, sizeof(count));
+    memset(bytes, 0, sizeof(bytes));
+}
+
+void ResourceRegistry::add(ResourceType type, uint64_t handle,
+                           const char *name, VkDeviceSize size, bool lazy) {
+    if (!handle) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    entry e = { name, size, lazy };
+    if (!live.insert(std::make_pair(key(type, handle), e)).second) {
+        LOGE("%s %s 0x%llx tracked twice", kTypeNames[type], name,
+             (unsigned long long)handle);
+        return;
+    }
+    count[type]++;
+    bytes[type] += size;
+    if (lazy) {
+        lazyBytes += size;
+    }
+    created++;
+    if (bytes[RESOURCE_DEVICE_MEMORY] > peakDeviceMemoryBytes) {
+        peakDeviceMemoryBytes = bytes[RESOURCE_DEVICE_MEMORY];
+    }
+}
+
+void ResourceRegistry::remove(ResourceType type, uint64_t handle) {
+    if (!handle) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<key, entry>::iterator it = live.find(key(type, handle));
+    if (it == live.end()) {
+        LOGE("untracked %s 0x%llx destroyed", kTypeNames[type],
+             (unsigned long long)handle);
+        return;
+    }
+    count[type]--;
+    bytes[type] -= it->second.bytes;
+    if (it->second.lazy) {
+        lazyBytes -= it->second.bytes;
+    }
+    destroyed++;
+    live.erase(it);
+}
+
+void ResourceRegistry::getTotals(resource_totals *totals) {
+    std::lock_guard<std::mutex> guard(lock);
+    memcpy(totals->count, count, sizeof(count));
+    memcpy(totals->bytes, bytes, sizeof(bytes));
+    totals->liveCount = (uint32_t)live.size();
+    totals->boundBytes = bytes[RESOURCE_BUFFER] + bytes[RESOURCE_IMAGE];
+    totals->deviceMemoryBytes = bytes[RESOURCE_DEVICE_MEMORY];
+    totals->lazyBytes = lazyBytes;
+    totals->peakDeviceMemoryBytes = peakDeviceMemoryBytes;
+    totals->created = created;
+    totals->destroyed = destroyed;
+}
+
+void ResourceRegistry::report(const char *when) {
+    resource_totals totals;
+    getTotals(&totals);
+    LOGI("%s: %u live objects, %.2f MiB device memory (peak %.2f MiB, "
+         "%.2f MiB lazily allocated), %.2f MiB bound, %llu created, "
+         "%llu destroyed", when, totals.liveCount,
+         totals.deviceMemoryBytes / kMiB, totals.peakDeviceMemoryBytes / kMiB,
+         totals.lazyBytes / kMiB, totals.boundBytes / kMiB,
+         (unsigned long long)totals.created,
+         (unsigned long long)totals.destroyed);
+    for (uint32_t i = 0; i < RESOURCE_TYPE_NUM; i++) {
+        if (!totals.count[i]) {
+            continue;
+        }
+        if (totals.bytes[i]) {
+            LOGI("  %s: %u, %.2f MiB", kTypeNames[i], totals.count[i],
+                 totals.bytes[i] / kMiB);
+        } else {
+            LOGI("  %s: %u", kTypeNames[i], totals.count[i]);
+        }
+    }
+}
+
+uint32_t ResourceRegistry::reportLive() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (std::map<key, entry>::iterator it = live.begin(); it != live.end();
+         ++it) {
+        LOGE("leaked %s %s 0x%llx, %llu bytes", kTypeNames[it->first.first],
+             it->second.name, (unsigned long long)it->first.second,
+             (unsigned long long)it->second.bytes);
+    }
+    return (uint32_t)live.size();
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_RESOURCEREGISTRY_H
+#define VULKANTEAPOT_RESOURCEREGISTRY_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <utility>
+#ifdef __ANDROID__
+#include "vulkan_wrapper.h"
+#else
+#include <vulkan/vulkan.h>
+#endif
+
+/*
+ * Kinds of Vulkan objects the registry keeps apart. Buffers and images
+ * carry the bytes of the allocation they are bound to, device memory the
+ * bytes of the VkDeviceMemory object, so the two add up to different things.
+ */
+enum ResourceType {
+    RESOURCE_DEVICE_MEMORY,
+    RESOURCE_BUFFER,
+    RESOURCE_IMAGE,
+    RESOURCE_IMAGE_VIEW,
+    RESOURCE_FRAMEBUFFER,
+    RESOURCE_RENDER_PASS,
+    RESOURCE_SHADER_MODULE,
+    RESOURCE_PIPELINE_CACHE,
+    RESOURCE_PIPELINE_LAYOUT,
+    RESOURCE_PIPELINE,
+    RESOURCE_DESCRIPTOR_SET_LAYOUT,
+    RESOURCE_DESCRIPTOR_POOL,
+    RESOURCE_COMMAND_POOL,
+    RESOURCE_COMMAND_BUFFER,
+    RESOURCE_FENCE,
+    RESOURCE_SEMAPHORE,
+    RESOURCE_SWAPCHAIN,
+    RESOURCE_SURFACE,
+    RESOURCE_TYPE_NUM,
+};
+
+typedef struct _resource_totals {
+    // Live objects and their bytes per ResourceType
+    uint32_t count[RESOURCE_TYPE_NUM];
+    VkDeviceSize bytes[RESOURCE_TYPE_NUM];
+    uint32_t liveCount;
+    // Bytes bound to live buffers and images
+    VkDeviceSize boundBytes;
+    // Bytes of live VkDeviceMemory objects, what the driver really reserved
+    VkDeviceSize deviceMemoryBytes;
+    // Of deviceMemoryBytes, lazily allocated. Transient attachments on
+    // tile-based GPUs, mostly never backed by real memory.
+    VkDeviceSize lazyBytes;
+    // Highest deviceMemoryBytes since the registry was created
+    VkDeviceSize peakDeviceMemoryBytes;
+    // Objects ever tracked and untracked
+    uint64_t created;
+    uint64_t destroyed;
+} resource_totals;
+
+/*
+ * Every Vulkan object the application creates is tracked here from
+ * creation to destruction, with a name and its byte count. Leaks show up as
+ * live objects at teardown, growth as totals that differ between two
+ * points that should be equivalent, e.g. two surface releases.
+ *
+ * Handles are keyed together with their type, names must be string
+ * literals or otherwise outlive the object.
+ */
+class ResourceRegistry {
+public:
+    ResourceRegistry();
+
+    // lazy marks device memory the driver only backs when it has to
+    template <typename T>
+    void track(ResourceType type, T handle, const char *name,
+               VkDeviceSize bytes = 0, bool lazy = false) {
+        add(type, (uint64_t)handle, name, bytes, lazy);
+    }
+    // VK_NULL_HANDLE is ignored like vkDestroy* ignores it
+    template <typename T>
+    void untrack(ResourceType type, T handle) {
+        remove(type, (uint64_t)handle);
+    }
+
+    void getTotals(resource_totals *totals);
+    // Logs the totals per type, prefixed with when
+    void report(const char *when);
+    // Logs every live object, returns their number
+    uint32_t reportLive();
+
+private:
+    typedef struct _entry {
+        const char *name;
+        VkDeviceSize bytes;
+        bool lazy;
+    } entry;
+    typedef std::pair<uint32_t, uint64_t> key;
+
+    std::map<key, entry> live;
+    uint32_t count[RESOURCE_TYPE_NUM];
+    VkDeviceSize bytes[RESOURCE_TYPE_NUM];
+    VkDeviceSize lazyBytes;
+    VkDeviceSize peakDeviceMemoryBytes;
+    uint64_t created;
+    uint64_t destroyed;
+    std::mutex lock;
+
+    void add(ResourceType type, uint64_t handle, const char *name,
+             VkDeviceSize size, bool lazy);
+    void remove(ResourceType type, uint64_t handle);
+};
+
+#endif //VULKANTEAPOT_RESOURCEREGISTRY_H
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_SPSCQUEUE_H
+#define VULKANTEAPOT_SPSCQUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+ * Lock-free ring buffer for exactly one producer thread and one consumer
+ * thread. Capacity has to be a power of two.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0,
+                  "Capacity has to be a power of two");
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Producer side, returns false when the queue is full
+    bool push(const T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[t & (Capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns false when the queue is empty
+    bool pop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) ==
+               tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[Capacity];
+    // Written by the consumer and the producer respectively, padded onto
+    // separate cache lines so the two threads do not false share
+    std::atomic<size_t> head;
+    char padding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+};
+
+#endif //VULKANTEAPOT_SPSCQUEUE_H
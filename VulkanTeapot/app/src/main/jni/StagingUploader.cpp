@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+#include "StagingUploader.h"
+#include "VulkanCall.h"
+
+static const char* kTAG = "StagingUploader";
+#ifdef __ANDROID__
+#define LOGI(...) \
+  ((void)__android_log_print(ANDROID_LOG_INFO, kTAG, __VA_ARGS__))
+#define LOGE(...) \
+  ((void)__android_log_print(ANDROID_LOG_ERROR, kTAG, __VA_ARGS__))
+#else
+#define LOG_LINE(stream, ...) \
+  ((void)(fprintf(stream, "%s: ", kTAG), fprintf(stream, __VA_ARGS__), \
+          fputc('\n', stream)))
+#define LOGI(...) LOG_LINE(stdout, __VA_ARGS__)
+#define LOGE(...) LOG_LINE(stderr, __VA_ARGS__)
+#endif
+
+StagingUploader::StagingUploader()
+    : device(VK_NULL_HANDLE), allocator(nullptr), registry(nullptr),
+      transferQueue(VK_NULL_HANDLE), transferFamily(0),
+      graphicsQueue(VK_NULL_HANDLE), graphicsFamily(0),
+      transferPool(VK_NULL_HANDLE), graphicsPool(VK_NULL_HANDLE),
+      pendingBytes(0)
+{
+}
+
+void StagingUploader::init(VkDevice device, GpuAllocator *allocator,
+                           ResourceRegistry *registry, VkQueue transferQueue,
+                           uint32_t transferFamily, VkQueue graphicsQueue,
+                           uint32_t graphicsFamily) {
+    this->device = device;
+    this->allocator = allocator;
+    this->registry = registry;
+    this->transferQueue = transferQueue;
+    this->transferFamily = transferFamily;
+    this->graphicsQueue = graphicsQueue;
+    this->graphicsFamily = graphicsFamily;
+
+    // Command buffers are recorded once and freed with their batch
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.pNext = nullptr;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = transferFamily;
+    CALL_VK(vkCreateCommandPool(device, &poolInfo, nullptr, &transferPool));
+    registry->track(RESOURCE_COMMAND_POOL, transferPool, "upload");
+    if (hasDedicatedTransferQueue()) {
+        poolInfo.queueFamilyIndex = graphicsFamily;
+        CALL_VK(vkCreateCommandPool(device, &poolInfo, nullptr,
+                                    &graphicsPool));
+        registry->track(RESOURCE_COMMAND_POOL, graphicsPool, "upload acquire");
+    } else {
+        graphicsPool = transferPool;
+    }
+
+    LOGI("uploads through queue family %u%s", transferFamily,
+         hasDedicatedTransferQueue() ? " (dedicated transfer)" : "");
+}
+
+void StagingUploader::destroy() {
+    waitIdle();
+    for (size_t i = 0; i < pending.size(); i++) {
+        registry->untrack(RESOURCE_BUFFER, pending[i].staging);
+        vkDestroyBuffer(device, pending[i].staging, nullptr);
+        allocator->free(&pending[i].stagingAlloc);
+    }
+    pending.clear();
+    if (graphicsPool != transferPool) {
+        registry->untrack(RESOURCE_COMMAND_POOL, graphicsPool);
+        vkDestroyCommandPool(device, graphicsPool, nullptr);
+    }
+    registry->untrack(RESOURCE_COMMAND_POOL, transferPool);
+    vkDestroyCommandPool(device, transferPool, nullptr);
+    transferPool = VK_NULL_HANDLE;
+    graphicsPool = VK_NULL_HANDLE;
+}
+
+bool StagingUploader::hasDedicatedTransferQueue() {
+    return transferFamily != graphicsFamily;
+}
+
+bool StagingUploader::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset,
+                                   const void *data, VkDeviceSize size,
+                                   VkPipelineStageFlags dstStage,
+                                   VkAccessFlags dstAccess) {
+    pending_upload upload;
+    upload.dst = dst;
+    upload.dstOffset = dstOffset;
+    upload.size = size;
+    upload.dstStage = dstStage;
+    upload.dstAccess = dstAccess;
+
+    VkBufferCreateInfo bufInfo = {};
+    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufInfo.pNext = nullptr;
+    bufInfo.size = size;
+    bufInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufInfo, nullptr, &upload.staging) !=
+        VK_SUCCESS) {
+        LOGE("Cannot create a %u byte staging buffer", (uint32_t)size);
+        return false;
+    }
+
+    VkMemoryRequirements memReq;
+    vkGetBufferMemoryRequirements(device, upload.staging, &memReq);
+    uint32_t memoryType;
+    if (!allocator->findMemoryType(memReq.memoryTypeBits, MEMORY_USAGE_UPLOAD,
+                                   &memoryType) ||
+        !allocator->allocate(memReq, memoryType, false,
+                             &upload.stagingAlloc)) {
+        vkDestroyBuffer(device, upload.staging, nullptr);
+        return false;
+    }
+    registry->track(RESOURCE_BUFFER, upload.staging, "staging",
+                    upload.stagingAlloc.size);
+    CALL_VK(vkBindBufferMemory(device, upload.staging,
+                               upload.stagingAlloc.memory,
+                               upload.stagingAlloc.offset));
+    // Coherent memory, the copy is visible to the transfer without a flush
+    memcpy(upload.stagingAlloc.mapped, data, size);
+
+    pending.push_back(upload);
+    pendingBytes += size;
+    return true;
+}
+
+VkCommandBuffer StagingUploader::beginCommands(VkCommandPool pool) {
+    VkCommandBufferAllocateInfo cmdInfo = {};
+    cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdInfo.pNext = nullptr;
+    cmdInfo.commandPool = pool;
+    cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdInfo.commandBufferCount = 1;
+    VkCommandBuffer cmd;
+    CALL_VK(vkAllocateCommandBuffers(device, &cmdInfo, &cmd));
+    registry->track(RESOURCE_COMMAND_BUFFER, cmd, "upload");
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = nullptr;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+    CALL_VK(vkBeginCommandBuffer(cmd, &beginInfo));
+    return cmd;
+}
+
+/*
+ * Same family: copies and a barrier making them visible to dstStage, all
+ * on the graphics queue.
+ * Separate families: copies and release barriers on the transfer queue, a
+ * semaphore, then the matching acquire barriers on the graphics queue. The
+ * fence is on the graphics submission, which finishes last.
+ */
+bool StagingUploader::flush() {
+    retire();
+    if (pending.empty()) {
+        return true;
+    }
+
+    upload_batch batch;
+    batch.released = VK_NULL_HANDLE;
+    batch.acquireCmd = VK_NULL_HANDLE;
+    batch.transferCmd = beginCommands(transferPool);
+    bool dedicated = hasDedicatedTransferQueue();
+
+    std::vector<VkBufferMemoryBarrier> barriers(pending.size());
+    VkPipelineStageFlags dstStages = 0;
+    for (size_t i = 0; i < pending.size(); i++) {
+        VkBufferCopy region = {};
+        region.srcOffset = 0;
+        region.dstOffset = pending[i].dstOffset;
+        region.size = pending[i].size;
+        vkCmdCopyBuffer(batch.transferCmd, pending[i].staging, pending[i].dst,
+                        1, &region);
+
+        VkBufferMemoryBarrier &barrier = barriers[i];
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        // The release side of an ownership transfer has no destination
+        barrier.dstAccessMask = dedicated ? 0 : pending[i].dstAccess;
+        barrier.srcQueueFamilyIndex =
+                dedicated ? transferFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex =
+                dedicated ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = pending[i].dst;
+        barrier.offset = pending[i].dstOffset;
+        barrier.size = pending[i].size;
+        dstStages |= pending[i].dstStage;
+    }
+    vkCmdPipelineBarrier(batch.transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         dedicated ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+                                   : dstStages,
+                         0, 0, nullptr, (uint32_t)barriers.size(),
+                         barriers.data(), 0, nullptr);
+    CALL_VK(vkEndCommandBuffer(batch.transferCmd));
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.pNext = nullptr;
+    fenceInfo.flags = 0;
+    CALL_VK(vkCreateFence(device, &fenceInfo, nullptr, &batch.fence));
+    registry->track(RESOURCE_FENCE, batch.fence, "upload");
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = nullptr;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.transferCmd;
+
+    if (!dedicated) {
+        CALL_VK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch.fence));
+    } else {
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = nullptr;
+        semaphoreInfo.flags = 0;
+        CALL_VK(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                                  &batch.released));
+        registry->track(RESOURCE_SEMAPHORE, batch.released, "upload release");
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &batch.released;
+        CALL_VK(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+        batch.acquireCmd = beginCommands(graphicsPool);
+        for (size_t i = 0; i < barriers.size(); i++) {
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = pending[i].dstAccess;
+        }
+        // Source stages match the semaphore wait so the dependency chains
+        vkCmdPipelineBarrier(batch.acquireCmd, dstStages, dstStages, 0, 0,
+                             nullptr, (uint32_t)barriers.size(),
+                             barriers.data(), 0, nullptr);
+        CALL_VK(vkEndCommandBuffer(batch.acquireCmd));
+
+        VkSubmitInfo acquireInfo = {};
+        acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        acquireInfo.pNext = nullptr;
+        acquireInfo.waitSemaphoreCount = 1;
+        acquireInfo.pWaitSemaphores = &batch.released;
+        acquireInfo.pWaitDstStageMask = &dstStages;
+        acquireInfo.commandBufferCount = 1;
+        acquireInfo.pCommandBuffers = &batch.acquireCmd;
+        CALL_VK(vkQueueSubmit(graphicsQueue, 1, &acquireInfo, batch.fence));
+    }
+
+    LOGI("%u uploads, %.1f KiB submitted", (uint32_t)pending.size(),
+         pendingBytes / 1024.0);
+    batch.uploads.swap(pending);
+    pendingBytes = 0;
+    inFlight.push_back(batch);
+    return true;
+}
+
+void StagingUploader::releaseBatch(upload_batch &batch) {
+    for (size_t i = 0; i < batch.uploads.size(); i++) {
+        registry->untrack(RESOURCE_BUFFER, batch.uploads[i].staging);
+        vkDestroyBuffer(device, batch.uploads[i].staging, nullptr);
+        allocator->free(&batch.uploads[i].stagingAlloc);
+    }
+    registry->untrack(RESOURCE_COMMAND_BUFFER, batch.transferCmd);
+    vkFreeCommandBuffers(device, transferPool, 1, &batch.transferCmd);
+    if (batch.acquireCmd != VK_NULL_HANDLE) {
+        registry->untrack(RESOURCE_COMMAND_BUFFER, batch.acquireCmd);
+        vkFreeCommandBuffers(device, graphicsPool, 1, &batch.acquireCmd);
+    }
+    if (batch.released != VK_NULL_HANDLE) {
+        registry->untrack(RESOURCE_SEMAPHORE, batch.released);
+        vkDestroySemaphore(device, batch.released, nullptr);
+    }
+    registry->untrack(RESOURCE_FENCE, batch.fence);
+    vkDestroyFence(device, batch.fence, nullptr);
+}
+
+void StagingUploader::retire() {
+    size_t kept = 0;
+    for (size_t i = 0; i < inFlight.size(); i++) {
+        if (vkGetFenceStatus(device, inFlight[i].fence) == VK_SUCCESS) {
+            releaseBatch(inFlight[i]);
+        } else {
+            inFlight[kept++] = inFlight[i];
+        }
+    }
+    inFlight.resize(kept);
+}
+
+void StagingUploader::waitIdle() {
+    for (size_t i = 0; i < inFlight.size(); i++) {
+        CALL_VK(vkWaitForFences(device, 1, &inFlight[i].fence, VK_TRUE,
+                                UINT64_MAX));
+    }
+    retire();
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_STAGINGUPLOADER_H
+#define VULKANTEAPOT_STAGINGUPLOADER_H
+
+#include <stdint.h>
+#include <vector>
+#include "GpuAllocator.h"
+
+/*
+ * Copies data into DEVICE_LOCAL buffers through host visible staging
+ * buffers. Uploads are recorded on the transfer queue, a dedicated one when
+ * the device has it, and handed over to the graphics queue with a queue
+ * family ownership transfer. Staging memory is released once the fence of
+ * its batch has signaled, nothing blocks unless waitIdle() is called.
+ */
+class StagingUploader {
+public:
+    StagingUploader();
+
+    // Both queue families may be the same
+    void init(VkDevice device, GpuAllocator *allocator,
+              ResourceRegistry *registry, VkQueue transferQueue,
+              uint32_t transferFamily, VkQueue graphicsQueue,
+              uint32_t graphicsFamily);
+    // Waits for the uploads in flight and frees everything
+    void destroy();
+
+    // Queues a copy of size bytes to dst at dstOffset. dst needs
+    // VK_BUFFER_USAGE_TRANSFER_DST_BIT. dstStage and dstAccess describe the
+    // first use of the data on the graphics queue.
+    bool uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data,
+                      VkDeviceSize size, VkPipelineStageFlags dstStage,
+                      VkAccessFlags dstAccess);
+    // Submits everything queued since the last flush. Graphics work
+    // submitted afterwards sees the data.
+    bool flush();
+    // Releases the staging memory of finished batches, cheap enough to call
+    // every frame
+    void retire();
+    void waitIdle();
+
+    bool hasDedicatedTransferQueue();
+
+private:
+    typedef struct _pending_upload {
+        VkBuffer dst;
+        VkDeviceSize dstOffset;
+        VkDeviceSize size;
+        VkPipelineStageFlags dstStage;
+        VkAccessFlags dstAccess;
+        VkBuffer staging;
+        gpu_allocation stagingAlloc;
+    } pending_upload;
+
+    typedef struct _upload_batch {
+        VkFence fence;
+        // Only used with a separate transfer family
+        VkSemaphore released;
+        VkCommandBuffer transferCmd;
+        VkCommandBuffer acquireCmd;
+        std::vector<pending_upload> uploads;
+    } upload_batch;
+
+    VkDevice device;
+    GpuAllocator *allocator;
+    ResourceRegistry *registry;
+    VkQueue transferQueue;
+    uint32_t transferFamily;
+    VkQueue graphicsQueue;
+    uint32_t graphicsFamily;
+    VkCommandPool transferPool;
+    VkCommandPool graphicsPool;
+
+    std::vector<pending_upload> pending;
+    std::vector<upload_batch> inFlight;
+    VkDeviceSize pendingBytes;
+
+    VkCommandBuffer beginCommands(VkCommandPool pool);
+    void releaseBatch(upload_batch &batch);
+};
+
+#endif //VULKANTEAPOT_STAGINGUPLOADER_H
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cassert>
+#include "TransformState.h"
+#include "MatrixBatch.h"
+#include "glm/gtx/simd_mat4.hpp"
+
+// glm 0.9.5 only enables its SSE2 code for gcc, clang builds fall back to
+// GLM_ARCH_PURE even on x86 unless GLM_FORCE_SSE2 is set. The build passes
+// it for the x86 ABIs so every file sees the same glm configuration.
+//
+// simdMat4 needs 16 byte alignment, keep it to locals and convert back
+static inline void multiply(const glm::mat4 &a, const glm::mat4 &b,
+                            glm::mat4 &out) {
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+    out = glm::mat4_cast(glm::simdMat4(a) * glm::simdMat4(b));
+#else
+    out = a * b;
+#endif
+}
+
+TransformState::TransformState()
+    : dirty(DIRTY_CLIP | DIRTY_PROJECTION | DIRTY_VIEW | DIRTY_MODEL |
+            DIRTY_OBJECTS),
+      mvpStale(true), clip(1.0f), projection(1.0f), view(1.0f), model(1.0f),
+      viewProjection(1.0f)
+{
+}
+
+void TransformState::setClip(const glm::mat4 &clip) {
+    this->clip = clip;
+    dirty |= DIRTY_CLIP;
+}
+
+void TransformState::setProjection(const glm::mat4 &projection) {
+    this->projection = projection;
+    dirty |= DIRTY_PROJECTION;
+}
+
+void TransformState::setView(const glm::mat4 &view) {
+    this->view = view;
+    dirty |= DIRTY_VIEW;
+}
+
+void TransformState::setModel(const glm::mat4 &model) {
+    this->model = model;
+    dirty |= DIRTY_MODEL;
+}
+
+void TransformState::setObjectPlacement(
+        const std::vector<glm::mat4> &placement) {
+    objectPlacement = placement;
+    objectViewProjection.resize(placement.size());
+    objectMVP.resize(placement.size());
+    dirty |= DIRTY_OBJECTS;
+}
+
+void TransformState::update() {
+    if (!dirty) {
+        return;
+    }
+
+    bool viewProjectionChanged =
+            (dirty & (DIRTY_CLIP | DIRTY_PROJECTION | DIRTY_VIEW)) != 0;
+    if (viewProjectionChanged) {
+        glm::mat4 clipProjection;
+        multiply(clip, projection, clipProjection);
+        multiply(clipProjection, view, viewProjection);
+    }
+
+    if ((viewProjectionChanged || (dirty & DIRTY_OBJECTS)) &&
+        !objectPlacement.empty()) {
+        multiplyBatch(viewProjection, objectPlacement.data(),
+                      objectPlacement.size(), objectViewProjection.data(),
+                      sizeof(glm::mat4));
+    }
+
+    // Anything dirty ends up changing every object's final product
+    mvpStale = true;
+    dirty = 0;
+}
+
+void TransformState::writeObjectMVPs(void *dst, size_t stride) {
+    update();
+    if (!objectViewProjection.empty()) {
+        multiplyBatch(objectViewProjection.data(), model,
+                      objectViewProjection.size(), dst, stride);
+    }
+}
+
+const glm::mat4 &TransformState::getViewProjection() {
+    update();
+    return viewProjection;
+}
+
+const glm::mat4 &TransformState::getObjectMVP(uint32_t index) {
+    assert(index < objectMVP.size());
+    update();
+    if (mvpStale) {
+        writeObjectMVPs(objectMVP.data(), sizeof(glm::mat4));
+        mvpStale = false;
+    }
+    return objectMVP[index];
+}
+
+uint32_t TransformState::getObjectCount() {
+    return static_cast<uint32_t>(objectMVP.size());
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_TRANSFORMSTATE_H
+#define VULKANTEAPOT_TRANSFORMSTATE_H
+
+#include <stdint.h>
+#include <vector>
+#include "glm/glm.hpp"
+
+/*
+ * Camera and object transforms with the products that feed the shaders.
+ * Clip * Projection * View only changes on resize or camera moves, and the
+ * object placements only when the object count changes, so both products
+ * are cached behind dirty flags. A model rotation then costs one multiply
+ * per object, done in a batch by writeObjectMVPs().
+ */
+class TransformState {
+public:
+    TransformState();
+
+    void setClip(const glm::mat4 &clip);
+    void setProjection(const glm::mat4 &projection);
+    void setView(const glm::mat4 &view);
+    // Rotation shared by every object
+    void setModel(const glm::mat4 &model);
+    // Per object transform applied before the view, one entry per object
+    void setObjectPlacement(const std::vector<glm::mat4> &placement);
+
+    // Brings every cached product up to date, only what the setters
+    // touched since the last call is recomputed
+    void update();
+
+    const glm::mat4 &getViewProjection();
+    // Final transform of every object written with the given stride,
+    // meant for mapped uniform memory
+    void writeObjectMVPs(void *dst, size_t stride);
+    // Same products kept on the CPU side, for push constants
+    const glm::mat4 &getObjectMVP(uint32_t index);
+    uint32_t getObjectCount();
+
+private:
+    enum {
+        DIRTY_CLIP = 1 << 0,
+        DIRTY_PROJECTION = 1 << 1,
+        DIRTY_VIEW = 1 << 2,
+        DIRTY_MODEL = 1 << 3,
+        DIRTY_OBJECTS = 1 << 4,
+    };
+
+    uint32_t dirty;
+    // objectMVP is out of date, only refreshed by getObjectMVP()
+    bool mvpStale;
+
+    glm::mat4 clip;
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::mat4 model;
+    std::vector<glm::mat4> objectPlacement;
+
+    // Clip * Projection * View
+    glm::mat4 viewProjection;
+    // viewProjection * objectPlacement[i]
+    std::vector<glm::mat4> objectViewProjection;
+    // objectViewProjection[i] * model
+    std::vector<glm::mat4> objectMVP;
+};
+
+#endif //VULKANTEAPOT_TRANSFORMSTATE_H
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cassert>
+#include "UniformArena.h"
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    // Vulkan alignments are powers of two
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+UniformArena::UniformArena()
+    : mapped(nullptr), frameSize(0), frameCount(0), alignment(1),
+      atomSize(1), frameStart(0), used(0), highWater(0)
+{
+}
+
+void UniformArena::init(uint8_t *mapped, uint64_t frameSize,
+                        uint32_t frameCount, uint64_t alignment,
+                        uint64_t atomSize) {
+    assert(frameSize % atomSize == 0);
+    this->mapped = mapped;
+    this->frameSize = frameSize;
+    this->frameCount = frameCount;
+    this->alignment = alignment;
+    this->atomSize = atomSize;
+    frameStart = 0;
+    used = 0;
+    highWater = 0;
+}
+
+void UniformArena::beginFrame(uint32_t frameIndex) {
+    assert(frameIndex < frameCount);
+    frameStart = frameIndex * frameSize;
+    used = 0;
+}
+
+uint32_t UniformArena::allocate(uint64_t size, void **data) {
+    uint64_t offset = alignUp(used, alignment);
+    if (offset + size > frameSize) {
+        return UINT32_MAX;
+    }
+    used = offset + size;
+    if (used > highWater) {
+        highWater = used;
+    }
+    *data = mapped + frameStart + offset;
+    return (uint32_t)(frameStart + offset);
+}
+
+uint32_t UniformArena::allocateArray(uint64_t size, uint32_t count,
+                                     uint32_t *stride, void **data) {
+    assert(count > 0);
+    uint64_t elementStride = alignUp(size, alignment);
+    uint32_t offset = allocate(elementStride * (count - 1) + size, data);
+    if (offset != UINT32_MAX) {
+        *stride = (uint32_t)elementStride;
+    }
+    return offset;
+}
+
+void UniformArena::getWrittenRange(uint64_t *offset, uint64_t *size) {
+    *offset = frameStart;
+    *size = alignUp(used, atomSize);
+}
+
+uint64_t UniformArena::getFrameSize() {
+    return frameSize;
+}
+
+uint64_t UniformArena::getHighWater() {
+    return highWater;
+}
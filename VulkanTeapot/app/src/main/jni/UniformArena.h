@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_UNIFORMARENA_H
+#define VULKANTEAPOT_UNIFORMARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Linear sub-allocator over a persistently mapped uniform buffer that is
+ * split into one region per frame in flight. Every frame starts with an
+ * empty region, allocations are aligned to minUniformBufferOffsetAlignment
+ * and their offset is meant to be passed as a dynamic offset, so any number
+ * of objects share one UNIFORM_BUFFER_DYNAMIC descriptor set.
+ *
+ * The arena does not own the Vulkan buffer, only hands out pieces of it.
+ */
+class UniformArena {
+public:
+    UniformArena();
+
+    // mapped points to frameCount regions of frameSize bytes each.
+    // frameSize has to be a multiple of atomSize so regions can be flushed
+    // independently.
+    void init(uint8_t *mapped, uint64_t frameSize, uint32_t frameCount,
+              uint64_t alignment, uint64_t atomSize);
+
+    // Only call once the GPU is done with the previous use of the region
+    void beginFrame(uint32_t frameIndex);
+
+    // Returns the offset from the start of the buffer and the CPU pointer
+    // to write to, or UINT32_MAX when the region is full
+    uint32_t allocate(uint64_t size, void **data);
+
+    // count allocations of size bytes back to back, element i is at the
+    // returned offset plus i * stride. Lets batched writers fill a whole
+    // array in one pass.
+    uint32_t allocateArray(uint64_t size, uint32_t count, uint32_t *stride,
+                           void **data);
+
+    // Part of the current region written this frame, rounded to whole
+    // atoms, for vkFlushMappedMemoryRanges on non-coherent memory
+    void getWrittenRange(uint64_t *offset, uint64_t *size);
+
+    uint64_t getFrameSize();
+    // Most bytes a single frame ever used
+    uint64_t getHighWater();
+
+private:
+    uint8_t *mapped;
+    uint64_t frameSize;
+    uint32_t frameCount;
+    uint64_t alignment;
+    uint64_t atomSize;
+
+    uint64_t frameStart;
+    uint64_t used;
+    uint64_t highWater;
+};
+
+#endif //VULKANTEAPOT_UNIFORMARENA_H
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <cstring>
+#include "VertexPacker.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define VERTEX_PACKER_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VERTEX_PACKER_NEON
+#endif
+
+void initVertexLayout(vertex_layout *layout) {
+    memset(layout, 0, sizeof(*layout));
+    for (int c = 0; c < 3; c++) {
+        layout->positionScale[c] = 1.0f;
+    }
+}
+
+bool addVertexAttribute(vertex_layout *layout, uint32_t semantic,
+                        uint32_t format, uint32_t binding) {
+    if (layout->attributeCount == VERTEX_LAYOUT_MAX_ATTRIBUTES ||
+        binding >= VERTEX_LAYOUT_MAX_BINDINGS ||
+        !isMeshFormatAllowed(semantic, format)) {
+        return false;
+    }
+    vertex_layout_attribute &attribute =
+            layout->attributes[layout->attributeCount++];
+    attribute.semantic = semantic;
+    attribute.format = format;
+    attribute.binding = binding;
+    attribute.offset = layout->strides[binding];
+    layout->strides[binding] += getMeshFormatSize(format);
+    if (binding >= layout->bindingCount) {
+        layout->bindingCount = binding + 1;
+    }
+    return true;
+}
+
+void initVertexLayout(vertex_layout *layout, const mesh_file_header &header,
+                      const mesh_file_attribute *attributes) {
+    initVertexLayout(layout);
+    layout->attributeCount = header.attributeCount;
+    layout->bindingCount = 1;
+    layout->strides[0] = header.vertexStride;
+    for (uint32_t i = 0; i < header.attributeCount; i++) {
+        layout->attributes[i].semantic = attributes[i].semantic;
+        layout->attributes[i].format = attributes[i].format;
+        layout->attributes[i].binding = 0;
+        layout->attributes[i].offset = attributes[i].offset;
+    }
+    memcpy(layout->positionScale, header.positionScale,
+           sizeof(layout->positionScale));
+    memcpy(layout->positionBias, header.positionBias,
+           sizeof(layout->positionBias));
+}
+
+const vertex_layout_attribute *findVertexAttribute(
+        const vertex_layout *layout, uint32_t semantic) {
+    for (uint32_t i = 0; i < layout->attributeCount; i++) {
+        if (layout->attributes[i].semantic == semantic) {
+            return &layout->attributes[i];
+        }
+    }
+    return nullptr;
+}
+
+namespace {
+
+// Per layout values the conversions need, scale is already inverted
+struct pack_constants {
+    float positionScale[3];
+    float positionBias[3];
+};
+
+}
+
+/*
+ * Scalar conversions. Every step is its own statement in the same order
+ * as the SIMD kernels, so no multiply-add gets contracted into an FMA on
+ * one path only and both paths produce the same bytes.
+ */
+
+static inline float clampUnit(float value) {
+    float low = value < -1.0f ? -1.0f : value;
+    return low > 1.0f ? 1.0f : low;
+}
+
+static inline int32_t roundHalfAway(float value) {
+    float half = value < 0.0f ? -0.5f : 0.5f;
+    float biased = value + half;
+    return (int32_t)biased;
+}
+
+static inline uint32_t toSnorm16(float value) {
+    float scaled = clampUnit(value) * 32767.0f;
+    return (uint32_t)roundHalfAway(scaled) & 0xffff;
+}
+
+static inline uint32_t toUnorm10(float value) {
+    float shifted = clampUnit(value) + 1.0f;
+    float scaled = shifted * 511.5f;
+    return (uint32_t)roundHalfAway(scaled);
+}
+
+static inline float signNotZero(float value) {
+    return value < 0.0f ? -1.0f : 1.0f;
+}
+
+// Round to nearest even, NaN becomes a quiet NaN, overflow infinity
+static inline uint32_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = bits & 0x80000000u;
+    uint32_t absBits = bits ^ sign;
+    uint32_t half;
+    if (absBits >= 0x47800000u) {
+        half = absBits > 0x7f800000u ? 0x7e00u : 0x7c00u;
+    } else if (absBits < 0x38800000u) {
+        // Adding 0.5 lines the subnormal mantissa up with the bottom bits
+        float magnitude;
+        memcpy(&magnitude, &absBits, sizeof(magnitude));
+        float aligned = magnitude + 0.5f;
+        uint32_t alignedBits;
+        memcpy(&alignedBits, &aligned, sizeof(alignedBits));
+        half = alignedBits - 0x3f000000u;
+    } else {
+        // Rebias the exponent and round, ties go to the even mantissa
+        uint32_t odd = (absBits >> 13) & 1;
+        half = (absBits + 0xc8000fffu + odd) >> 13;
+    }
+    return half | (sign >> 16);
+}
+
+static void packVertex(uint32_t format, const float *src,
+                       const pack_constants &k, uint8_t *dst) {
+    uint32_t words[2];
+    switch (format) {
+        case MESH_FORMAT_FLOAT32X3:
+            memcpy(dst, src, 3 * sizeof(float));
+            return;
+        case MESH_FORMAT_FLOAT32X2:
+            memcpy(dst, src, 2 * sizeof(float));
+            return;
+        case MESH_FORMAT_SNORM16X4: {
+            uint32_t q[3];
+            for (int c = 0; c < 3; c++) {
+                float centered = src[c] - k.positionBias[c];
+                float unit = centered * k.positionScale[c];
+                q[c] = toSnorm16(unit);
+            }
+            words[0] = q[0] | q[1] << 16;
+            words[1] = q[2] | 32767u << 16;
+            memcpy(dst, words, 2 * sizeof(uint32_t));
+            return;
+        }
+        case MESH_FORMAT_UNORM10X3:
+            words[0] = toUnorm10(src[0]) | toUnorm10(src[1]) << 10 |
+                       toUnorm10(src[2]) << 20;
+            break;
+        case MESH_FORMAT_OCT_SNORM16X2: {
+            float length = fabsf(src[0]) + fabsf(src[1]);
+            length = length + fabsf(src[2]);
+            float x = length > 0.0f ? src[0] / length : 0.0f;
+            float y = length > 0.0f ? src[1] / length : 0.0f;
+            if (src[2] < 0.0f) {
+                float foldedX = (1.0f - fabsf(y)) * signNotZero(x);
+                float foldedY = (1.0f - fabsf(x)) * signNotZero(y);
+                x = foldedX;
+                y = foldedY;
+            }
+            words[0] = toSnorm16(x) | toSnorm16(y) << 16;
+            break;
+        }
+        case MESH_FORMAT_FLOAT16X2:
+            words[0] = floatToHalf(src[0]) | floatToHalf(src[1]) << 16;
+            break;
+        default:
+            return;
+    }
+    memcpy(dst, words, sizeof(uint32_t));
+}
+
+#if defined(VERTEX_PACKER_SSE2)
+
+typedef __m128 float4;
+typedef __m128i int4;
+typedef __m128 mask4;
+
+static inline float4 splat(float value) { return _mm_set1_ps(value); }
+static inline int4 splatInt(int32_t value) { return _mm_set1_epi32(value); }
+static inline float4 add(float4 a, float4 b) { return _mm_add_ps(a, b); }
+static inline float4 sub(float4 a, float4 b) { return _mm_sub_ps(a, b); }
+static inline float4 mul(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+static inline float4 div(float4 a, float4 b) { return _mm_div_ps(a, b); }
+static inline float4 abs(float4 a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+}
+static inline mask4 lessThan(float4 a, float4 b) { return _mm_cmplt_ps(a, b); }
+static inline float4 select(mask4 mask, float4 a, float4 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+static inline float4 clampUnit(float4 a) {
+    return _mm_min_ps(_mm_max_ps(a, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+}
+static inline int4 roundHalfAway(float4 a) {
+    float4 half = _mm_or_ps(_mm_set1_ps(0.5f),
+                            _mm_and_ps(a, _mm_set1_ps(-0.0f)));
+    return _mm_cvttps_epi32(_mm_add_ps(a, half));
+}
+static inline int4 orInt(int4 a, int4 b) { return _mm_or_si128(a, b); }
+static inline int4 andInt(int4 a, int4 b) { return _mm_and_si128(a, b); }
+template <int bits> static inline int4 shiftLeft(int4 a) {
+    return _mm_slli_epi32(a, bits);
+}
+static inline void store(uint32_t *dst, int4 a) {
+    _mm_storeu_si128((__m128i *)dst, a);
+}
+
+// Four vertices of 4 floats each, transposed so out[c] holds component c
+// of every vertex
+static inline void load4(const uint8_t *src, size_t stride, float4 out[4]) {
+    out[0] = _mm_loadu_ps((const float *)src);
+    out[1] = _mm_loadu_ps((const float *)(src + stride));
+    out[2] = _mm_loadu_ps((const float *)(src + 2 * stride));
+    out[3] = _mm_loadu_ps((const float *)(src + 3 * stride));
+    _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+}
+
+static inline int4 floatToHalf(float4 value) {
+    int4 bits = _mm_castps_si128(value);
+    int4 sign = _mm_and_si128(bits, _mm_set1_epi32((int32_t)0x80000000u));
+    int4 absBits = _mm_xor_si128(bits, sign);
+    // Signed compares are fine with the sign cleared
+    int4 isRegular = _mm_cmplt_epi32(absBits, _mm_set1_epi32(0x47800000));
+    int4 isNan = _mm_cmpgt_epi32(absBits, _mm_set1_epi32(0x7f800000));
+    int4 special = _mm_or_si128(_mm_set1_epi32(0x7c00),
+                                _mm_and_si128(isNan, _mm_set1_epi32(0x200)));
+    int4 isSubnormal = _mm_cmplt_epi32(absBits, _mm_set1_epi32(0x38800000));
+    float4 aligned = _mm_add_ps(_mm_castsi128_ps(absBits), _mm_set1_ps(0.5f));
+    int4 subnormal = _mm_sub_epi32(_mm_castps_si128(aligned),
+                                   _mm_set1_epi32(0x3f000000));
+    int4 odd = _mm_and_si128(_mm_srli_epi32(absBits, 13), _mm_set1_epi32(1));
+    int4 normal = _mm_add_epi32(absBits,
+                                _mm_set1_epi32((int32_t)0xc8000fffu));
+    normal = _mm_srli_epi32(_mm_add_epi32(normal, odd), 13);
+    int4 half = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal),
+                             _mm_andnot_si128(isSubnormal, normal));
+    half = _mm_or_si128(_mm_and_si128(isRegular, half),
+                        _mm_andnot_si128(isRegular, special));
+    return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+}
+
+const char *getVertexPackerPath() {
+    return "SSE2";
+}
+
+#elif defined(VERTEX_PACKER_NEON)
+
+typedef float32x4_t float4;
+typedef int32x4_t int4;
+typedef uint32x4_t mask4;
+
+static inline float4 splat(float value) { return vdupq_n_f32(value); }
+static inline int4 splatInt(int32_t value) { return vdupq_n_s32(value); }
+static inline float4 add(float4 a, float4 b) { return vaddq_f32(a, b); }
+static inline float4 sub(float4 a, float4 b) { return vsubq_f32(a, b); }
+static inline float4 mul(float4 a, float4 b) { return vmulq_f32(a, b); }
+// ARMv7 has no vector divide, the reciprocal estimate would not match the
+// scalar path
+static inline float4 div(float4 a, float4 b) {
+#if defined(__aarch64__)
+    return vdivq_f32(a, b);
+#else
+    float x[4];
+    float y[4];
+    vst1q_f32(x, a);
+    vst1q_f32(y, b);
+    for (int i = 0; i < 4; i++) {
+        x[i] /= y[i];
+    }
+    return vld1q_f32(x);
+#endif
+}
+static inline float4 abs(float4 a) { return vabsq_f32(a); }
+static inline mask4 lessThan(float4 a, float4 b) { return vcltq_f32(a, b); }
+static inline float4 select(mask4 mask, float4 a, float4 b) {
+    return vbslq_f32(mask, a, b);
+}
+static inline float4 clampUnit(float4 a) {
+    return vminq_f32(vmaxq_f32(a, vdupq_n_f32(-1.0f)), vdupq_n_f32(1.0f));
+}
+static inline int4 roundHalfAway(float4 a) {
+    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(a),
+                                vdupq_n_u32(0x80000000u));
+    float4 half = vreinterpretq_f32_u32(
+            vorrq_u32(vreinterpretq_u32_f32(vdupq_n_f32(0.5f)), sign));
+    return vcvtq_s32_f32(vaddq_f32(a, half));
+}
+static inline int4 orInt(int4 a, int4 b) { return vorrq_s32(a, b); }
+static inline int4 andInt(int4 a, int4 b) { return vandq_s32(a, b); }
+template <int bits> static inline int4 shiftLeft(int4 a) {
+    return vshlq_n_s32(a, bits);
+}
+static inline void store(uint32_t *dst, int4 a) {
+    vst1q_u32(dst, vreinterpretq_u32_s32(a));
+}
+
+static inline void load4(const uint8_t *src, size_t stride, float4 out[4]) {
+    float32x4x2_t low = vtrnq_f32(vld1q_f32((const float *)src),
+                                  vld1q_f32((const float *)(src + stride)));
+    float32x4x2_t high = vtrnq_f32(
+            vld1q_f32((const float *)(src + 2 * stride)),
+            vld1q_f32((const float *)(src + 3 * stride)));
+    out[0] = vcombine_f32(vget_low_f32(low.val[0]),
+                          vget_low_f32(high.val[0]));
+    out[1] = vcombine_f32(vget_low_f32(low.val[1]),
+                          vget_low_f32(high.val[1]));
+    out[2] = vcombine_f32(vget_high_f32(low.val[0]),
+                          vget_high_f32(high.val[0]));
+    out[3] = vcombine_f32(vget_high_f32(low.val[1]),
+                          vget_high_f32(high.val[1]));
+}
+
+static inline int4 floatToHalf(float4 value) {
+    uint32x4_t bits = vreinterpretq_u32_f32(value);
+    uint32x4_t sign = vandq_u32(bits, vdupq_n_u32(0x80000000u));
+    uint32x4_t absBits = veorq_u32(bits, sign);
+    uint32x4_t isRegular = vcltq_u32(absBits, vdupq_n_u32(0x47800000u));
+    uint32x4_t isNan = vcgtq_u32(absBits, vdupq_n_u32(0x7f800000u));
+    uint32x4_t special = vorrq_u32(vdupq_n_u32(0x7c00u),
+                                   vandq_u32(isNan, vdupq_n_u32(0x200u)));
+    uint32x4_t isSubnormal = vcltq_u32(absBits, vdupq_n_u32(0x38800000u));
+    float32x4_t aligned = vaddq_f32(vreinterpretq_f32_u32(absBits),
+                                    vdupq_n_f32(0.5f));
+    uint32x4_t subnormal = vsubq_u32(vreinterpretq_u32_f32(aligned),
+                                     vdupq_n_u32(0x3f000000u));
+    uint32x4_t odd = vandq_u32(vshrq_n_u32(absBits, 13), vdupq_n_u32(1));
+    uint32x4_t normal = vaddq_u32(absBits, vdupq_n_u32(0xc8000fffu));
+    normal = vshrq_n_u32(vaddq_u32(normal, odd), 13);
+    uint32x4_t half = vbslq_u32(isSubnormal, subnormal, normal);
+    half = vbslq_u32(isRegular, half, special);
+    return vreinterpretq_s32_u32(vorrq_u32(half, vshrq_n_u32(sign, 16)));
+}
+
+const char *getVertexPackerPath() {
+    return "NEON";
+}
+
+#else
+
+const char *getVertexPackerPath() {
+    return "scalar";
+}
+
+#endif
+
+#if defined(VERTEX_PACKER_SSE2) || defined(VERTEX_PACKER_NEON)
+
+static inline int4 toSnorm16(float4 value) {
+    float4 scaled = mul(clampUnit(value), splat(32767.0f));
+    return andInt(roundHalfAway(scaled), splatInt(0xffff));
+}
+
+static inline int4 toUnorm10(float4 value) {
+    float4 shifted = add(clampUnit(value), splat(1.0f));
+    return roundHalfAway(mul(shifted, splat(511.5f)));
+}
+
+static inline float4 signNotZero(float4 value) {
+    return select(lessThan(value, splat(0.0f)), splat(-1.0f), splat(1.0f));
+}
+
+// Four vertices of one attribute, v[c] holds component c of each. Writes
+// one or two 32 bit words per vertex, returns how many.
+static inline int packBlock(uint32_t format, const float4 v[4],
+                            const pack_constants &k, int4 words[2]) {
+    switch (format) {
+        case MESH_FORMAT_SNORM16X4: {
+            int4 q[3];
+            for (int c = 0; c < 3; c++) {
+                float4 centered = sub(v[c], splat(k.positionBias[c]));
+                q[c] = toSnorm16(mul(centered, splat(k.positionScale[c])));
+            }
+            words[0] = orInt(q[0], shiftLeft<16>(q[1]));
+            words[1] = orInt(q[2], splatInt(32767 << 16));
+            return 2;
+        }
+        case MESH_FORMAT_UNORM10X3:
+            words[0] = orInt(orInt(toUnorm10(v[0]),
+                                   shiftLeft<10>(toUnorm10(v[1]))),
+                             shiftLeft<20>(toUnorm10(v[2])));
+            return 1;
+        case MESH_FORMAT_OCT_SNORM16X2: {
+            float4 length = add(add(abs(v[0]), abs(v[1])), abs(v[2]));
+            mask4 nonZero = lessThan(splat(0.0f), length);
+            float4 x = select(nonZero, div(v[0], length), splat(0.0f));
+            float4 y = select(nonZero, div(v[1], length), splat(0.0f));
+            mask4 lower = lessThan(v[2], splat(0.0f));
+            float4 foldedX = mul(sub(splat(1.0f), abs(y)), signNotZero(x));
+            float4 foldedY = mul(sub(splat(1.0f), abs(x)), signNotZero(y));
+            x = select(lower, foldedX, x);
+            y = select(lower, foldedY, y);
+            words[0] = orInt(toSnorm16(x), shiftLeft<16>(toSnorm16(y)));
+            return 1;
+        }
+        case MESH_FORMAT_FLOAT16X2:
+            words[0] = orInt(floatToHalf(v[0]),
+                             shiftLeft<16>(floatToHalf(v[1])));
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+#endif
+
+// Vertices are packed a chunk at a time, every attribute of a chunk is
+// written while the chunk of each binding is still in cache
+#define VERTEX_PACK_CHUNK 256
+
+namespace {
+
+// One attribute of a layout, resolved against its stream and binding
+struct pack_attribute {
+    uint32_t format;
+    const uint8_t *src;
+    size_t srcStride;
+    uint8_t *dst;
+    size_t dstStride;
+};
+
+}
+
+static uint32_t initPack(const vertex_layout *layout,
+                         const vertex_stream *streams, void *const *dst,
+                         pack_constants *k, pack_attribute *attributes) {
+    for (int c = 0; c < 3; c++) {
+        k->positionScale[c] = 1.0f / layout->positionScale[c];
+        k->positionBias[c] = layout->positionBias[c];
+    }
+    for (uint32_t a = 0; a < layout->attributeCount; a++) {
+        const vertex_layout_attribute &attribute = layout->attributes[a];
+        const vertex_stream &stream = streams[attribute.semantic];
+        attributes[a].format = attribute.format;
+        attributes[a].src = (const uint8_t *)stream.data;
+        attributes[a].srcStride = stream.stride ?
+                stream.stride : stream.components * sizeof(float);
+        attributes[a].dst = (uint8_t *)dst[attribute.binding] +
+                            attribute.offset;
+        attributes[a].dstStride = layout->strides[attribute.binding];
+    }
+    return layout->attributeCount;
+}
+
+static void packRange(const pack_attribute &a, const pack_constants &k,
+                      size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        packVertex(a.format, (const float *)(a.src + i * a.srcStride), k,
+                   a.dst + i * a.dstStride);
+    }
+}
+
+void packVerticesScalar(const vertex_layout *layout,
+                        const vertex_stream *streams, size_t count,
+                        void *const *dst) {
+    pack_constants k;
+    pack_attribute attributes[VERTEX_LAYOUT_MAX_ATTRIBUTES];
+    uint32_t attributeCount = initPack(layout, streams, dst, &k, attributes);
+    for (size_t begin = 0; begin < count; begin += VERTEX_PACK_CHUNK) {
+        size_t end = begin + VERTEX_PACK_CHUNK < count ?
+                     begin + VERTEX_PACK_CHUNK : count;
+        for (uint32_t a = 0; a < attributeCount; a++) {
+            packRange(attributes[a], k, begin, end);
+        }
+    }
+}
+
+#if defined(VERTEX_PACKER_SSE2) || defined(VERTEX_PACKER_NEON)
+
+// Blocks of four vertices are converted in registers. A block reads 16
+// bytes from each vertex, which stays inside the stream as long as one
+// more vertex follows it, the rest goes through the scalar path.
+static void packRangeSimd(const pack_attribute &a, const pack_constants &k,
+                          size_t begin, size_t end, size_t count) {
+    size_t i = begin;
+    bool convert = a.format != MESH_FORMAT_FLOAT32X3 &&
+                   a.format != MESH_FORMAT_FLOAT32X2;
+    for (; convert && i + 4 <= end && i + 4 < count; i += 4) {
+        float4 v[4];
+        load4(a.src + i * a.srcStride, a.srcStride, v);
+        int4 words[2];
+        int wordCount = packBlock(a.format, v, k, words);
+        uint32_t lanes[2][4];
+        for (int w = 0; w < wordCount; w++) {
+            store(lanes[w], words[w]);
+        }
+        for (int j = 0; j < 4; j++) {
+            uint8_t *vertex = a.dst + (i + j) * a.dstStride;
+            for (int w = 0; w < wordCount; w++) {
+                memcpy(vertex + w * sizeof(uint32_t), &lanes[w][j],
+                       sizeof(uint32_t));
+            }
+        }
+    }
+    packRange(a, k, i, end);
+}
+
+void packVertices(const vertex_layout *layout, const vertex_stream *streams,
+                  size_t count, void *const *dst) {
+    pack_constants k;
+    pack_attribute attributes[VERTEX_LAYOUT_MAX_ATTRIBUTES];
+    uint32_t attributeCount = initPack(layout, streams, dst, &k, attributes);
+    for (size_t begin = 0; begin < count; begin += VERTEX_PACK_CHUNK) {
+        size_t end = begin + VERTEX_PACK_CHUNK < count ?
+                     begin + VERTEX_PACK_CHUNK : count;
+        for (uint32_t a = 0; a < attributeCount; a++) {
+            packRangeSimd(attributes[a], k, begin, end, count);
+        }
+    }
+}
+
+#else
+
+void packVertices(const vertex_layout *layout, const vertex_stream *streams,
+                  size_t count, void *const *dst) {
+    packVerticesScalar(layout, streams, count, dst);
+}
+
+#endif
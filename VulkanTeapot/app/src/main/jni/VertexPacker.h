@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_VERTEXPACKER_H
+#define VULKANTEAPOT_VERTEXPACKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MeshFile.h"
+
+/*
+ * Vertex layouts and the packer that fills them. A layout places each
+ * attribute in a binding, attributes sharing a binding are interleaved in
+ * the order they were added, so the same source streams can be packed
+ * interleaved or split into separate vertex buffers. Formats are the
+ * MeshAttributeFormat values, the renderer maps them to VkFormats and
+ * builds its vertex input state from the layout.
+ */
+#define VERTEX_LAYOUT_MAX_ATTRIBUTES MESH_FILE_MAX_ATTRIBUTES
+#define VERTEX_LAYOUT_MAX_BINDINGS 4
+
+typedef struct _vertex_layout_attribute {
+    // MeshAttributeSemantic, also the vertex shader input location
+    uint32_t semantic;
+    // MeshAttributeFormat
+    uint32_t format;
+    uint32_t binding;
+    // From the start of the vertex in its binding
+    uint32_t offset;
+} vertex_layout_attribute;
+
+typedef struct _vertex_layout {
+    uint32_t attributeCount;
+    uint32_t bindingCount;
+    vertex_layout_attribute attributes[VERTEX_LAYOUT_MAX_ATTRIBUTES];
+    uint32_t strides[VERTEX_LAYOUT_MAX_BINDINGS];
+    // MESH_FORMAT_SNORM16X4 positions are stored as
+    // (position - positionBias) / positionScale
+    float positionScale[3];
+    float positionBias[3];
+} vertex_layout;
+
+/*
+ * Float source data of one semantic, components floats per vertex with
+ * stride bytes between vertices, 0 for tightly packed. Positions, normals,
+ * tangents and binormals take 3 components, texcoords 2 or more, extra
+ * components are ignored.
+ */
+typedef struct _vertex_stream {
+    const float *data;
+    uint32_t components;
+    size_t stride;
+} vertex_stream;
+
+// Empty layout, identity position scale and bias
+void initVertexLayout(vertex_layout *layout);
+
+// Appends an attribute at the end of binding, false if the layout is full,
+// the format does not suit the semantic or the binding is out of range
+bool addVertexAttribute(vertex_layout *layout, uint32_t semantic,
+                        uint32_t format, uint32_t binding);
+
+// The layout of a mesh file, one interleaved binding
+void initVertexLayout(vertex_layout *layout, const mesh_file_header &header,
+                      const mesh_file_attribute *attributes);
+
+const vertex_layout_attribute *findVertexAttribute(
+        const vertex_layout *layout, uint32_t semantic);
+
+// Packs count vertices of streams, indexed by semantic, into dst, one
+// pointer per binding. Streams the layout does not use may have null data.
+// Normalized formats round to nearest with ties away from zero, half floats
+// to nearest even. Every code path produces the same bytes, short of
+// denormal inputs on ARMv7, whose NEON unit flushes them to zero.
+void packVertices(const vertex_layout *layout, const vertex_stream *streams,
+                  size_t count, void *const *dst);
+
+// Same result one vertex at a time without SIMD, for reference and
+// benchmarks
+void packVerticesScalar(const vertex_layout *layout,
+                        const vertex_stream *streams, size_t count,
+                        void *const *dst);
+
+// Name of the code path compiled in, for logs and benchmarks
+const char *getVertexPackerPath();
+
+#endif //VULKANTEAPOT_VERTEXPACKER_H
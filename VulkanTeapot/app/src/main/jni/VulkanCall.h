@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VULKANTEAPOT_VULKANCALL_H
+#define VULKANTEAPOT_VULKANCALL_H
+
+#include <cassert>
+
+/*
+ * CALL_VK for every translation unit. On Android vulkan_wrapper.h already
+ * defines it with logcat output, a second definition with another body
+ * would be a redefinition, so headless builds get the console equivalent.
+ */
+#ifdef __ANDROID__
+#include <android/log.h>
+#include "vulkan_wrapper.h"
+#else
+#include <cstdio>
+#include <vulkan/vulkan.h>
+
+// Vulkan call wrapper
+#define CALL_VK(func)                                                 \
+  if (VK_SUCCESS != (func)) {                                         \
+    fprintf(stderr, "Vulkan error. File[%s], line[%d]\n", __FILE__,   \
+            __LINE__);                                                \
+    assert(false);                                                    \
+  }
+#endif
+
+#endif //VULKANTEAPOT_VULKANCALL_H
@@ -16,24 +16,42 @@
 
 #include <vector>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <unistd.h>
+#include <time.h>
 
+#ifdef __ANDROID__
 #include <android/log.h>
 #include <android_native_app_glue.h>
+#endif
+#include "VulkanCall.h"
 #include "VulkanDevice.h"
-#include "teapot.inl"
+#include "MeshFile.h"
+#include "MeshOptimizer.h"
 
 
 #include "glm/gtc/matrix_transform.hpp"
 
-// Android log function wrappers
 static const char* kTAG = "Vulkan-Tutorial04";
+#ifdef __ANDROID__
+// Android log function wrappers
 #define LOGI(...) \
   ((void)__android_log_print(ANDROID_LOG_INFO, kTAG, __VA_ARGS__))
 #define LOGW(...) \
   ((void)__android_log_print(ANDROID_LOG_WARN, kTAG, __VA_ARGS__))
 #define LOGE(...) \
   ((void)__android_log_print(ANDROID_LOG_ERROR, kTAG, __VA_ARGS__))
+#else
+// Headless builds log to the console
+#define LOG_LINE(stream, ...) \
+  ((void)(fprintf(stream, "%s: ", kTAG), fprintf(stream, __VA_ARGS__), \
+          fputc('\n', stream)))
+#define LOGI(...) LOG_LINE(stdout, __VA_ARGS__)
+#define LOGW(...) LOG_LINE(stderr, __VA_ARGS__)
+#define LOGE(...) LOG_LINE(stderr, __VA_ARGS__)
+#endif
 
 #if defined(NDEBUG) && defined(__GNUC__)
 #define U_ASSERT_ONLY __attribute__((unused))
@@ -41,15 +59,153 @@ static const char* kTAG = "Vulkan-Tutorial04";
 #define U_ASSERT_ONLY
 #endif
 
+/* Swapchain images are rendered to and may be copied from */
+static const VkImageUsageFlags kSwapchainUsage =
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+/* Headless color format, read back as is by readPixels() */
+static const VkFormat kHeadlessFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+static const bool kDepthPresent = true;
+
+/* Vertex formats of the MeshAttributeFormat values */
+static const VkFormat kMeshFormats[MESH_FORMAT_NUM] = {
+        VK_FORMAT_R32G32B32_SFLOAT,         // MESH_FORMAT_FLOAT32X3
+        VK_FORMAT_R16G16B16A16_SNORM,       // MESH_FORMAT_SNORM16X4
+        VK_FORMAT_A2B10G10R10_UNORM_PACK32, // MESH_FORMAT_UNORM10X3
+        VK_FORMAT_R16G16_SNORM,             // MESH_FORMAT_OCT_SNORM16X2
+        VK_FORMAT_R32G32_SFLOAT,            // MESH_FORMAT_FLOAT32X2
+        VK_FORMAT_R16G16_SFLOAT,            // MESH_FORMAT_FLOAT16X2
+};
+
+/* Attribute semantics the vertex shaders read, others are not bound */
+static const uint32_t kShaderSemantics =
+        1u << MESH_ATTRIBUTE_POSITION | 1u << MESH_ATTRIBUTE_NORMAL;
+
+/* Values of the normalDecode specialization constant in the vertex shaders */
+enum NormalDecode {
+    NORMAL_DECODE_NONE,
+    NORMAL_DECODE_UNORM,
+    NORMAL_DECODE_OCTAHEDRAL,
+};
+
+/*
+ * Present modes in order of preference for each SwapchainPolicy, FIFO is
+ * always supported and ends every list. The swapchain gets
+ * minImageCount + kPolicyExtraImages[policy] images.
+ */
+static const VkPresentModeKHR kPolicyPresentModes[SWAPCHAIN_POLICY_NUM][3] = {
+        // Mailbox is the lowest-latency non-tearing mode, immediate is
+        // fastest though it tears
+        { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR,
+          VK_PRESENT_MODE_FIFO_KHR },
+        // Render at most once per vblank and keep few images around
+        { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR,
+          VK_PRESENT_MODE_FIFO_KHR },
+        // Never block on the display, prefer tearing over waiting
+        { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+          VK_PRESENT_MODE_FIFO_KHR },
+};
+static const uint32_t kPolicyExtraImages[SWAPCHAIN_POLICY_NUM] = { 1, 0, 2 };
+static const char *kPolicyNames[SWAPCHAIN_POLICY_NUM] = {
+        "lowest latency", "power saver", "max throughput",
+};
+
+/* Frames between two swapchain policy reports */
+#define POLICY_REPORT_FRAMES 300
+
+/* Longer gaps between frames are on-demand idle time, not throughput */
+#define MAX_FRAME_INTERVAL 250.0
+
+static double getTimeMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+VulkanDevice::VulkanDevice(android_app *app, ANativeWindow *window,
+                           uint32_t framesInFlight, TransformPath transformPath,
+                           const char *meshPath)
+    : surface_(VK_NULL_HANDLE), width(0), height(0), initialized(false),
+      headless(false), androidAppCtx(app), window_(window),
+      meshPath(meshPath),
+      swap_chain(VK_NULL_HANDLE),
+      swapchainPolicy(SWAPCHAIN_POLICY_LOWEST_LATENCY),
+      transformPath(transformPath), objectCount(1),
+      framesInFlight(framesInFlight), currentFrame(0), fenceWaitTime(0.0)
+{
+    init();
+}
 
-VulkanDevice::VulkanDevice(android_app *app)
-    : initialized(false), androidAppCtx(app)
+VulkanDevice::VulkanDevice(uint32_t width, uint32_t height,
+                           uint32_t framesInFlight, TransformPath transformPath,
+                           const char *meshPath)
+    : surface_(VK_NULL_HANDLE), width(width), height(height),
+      initialized(false), headless(true), androidAppCtx(nullptr),
+      window_(nullptr), meshPath(meshPath),
+      swap_chain(VK_NULL_HANDLE),
+      swapchainPolicy(SWAPCHAIN_POLICY_LOWEST_LATENCY),
+      transformPath(transformPath), objectCount(1),
+      framesInFlight(framesInFlight), currentFrame(0), fenceWaitTime(0.0)
 {
     init();
 }
 
+// Everything created below the device is destroyed here in reverse order
+// and untracked on the way, whatever the registry still holds afterwards
+// is a leak.
 VulkanDevice::~VulkanDevice() {
+    vkDeviceWaitIdle(device_);
+    if (headless) {
+        destroy_swap_chain_resources();
+        destroy_frame_resources();
+    } else {
+        // A device whose window is gone has done this already
+        releaseSurface();
+    }
+
+    registry.untrack(RESOURCE_PIPELINE, pipeline);
+    vkDestroyPipeline(device_, pipeline, nullptr);
+    registry.untrack(RESOURCE_PIPELINE_CACHE, pipelineCache);
+    vkDestroyPipelineCache(device_, pipelineCache, nullptr);
+    // Descriptor sets go with their pool
+    registry.untrack(RESOURCE_DESCRIPTOR_POOL, desc_pool);
+    vkDestroyDescriptorPool(device_, desc_pool, nullptr);
+    registry.untrack(RESOURCE_PIPELINE_LAYOUT, pipelineLayout);
     vkDestroyPipelineLayout(device_, pipelineLayout, nullptr);
+    for (size_t i = 0; i < desc_layout.size(); i++) {
+        registry.untrack(RESOURCE_DESCRIPTOR_SET_LAYOUT, desc_layout[i]);
+        vkDestroyDescriptorSetLayout(device_, desc_layout[i], nullptr);
+    }
+    registry.untrack(RESOURCE_SHADER_MODULE, vertexShader);
+    vkDestroyShaderModule(device_, vertexShader, nullptr);
+    registry.untrack(RESOURCE_SHADER_MODULE, fragmentShader);
+    vkDestroyShaderModule(device_, fragmentShader, nullptr);
+    registry.untrack(RESOURCE_RENDER_PASS, render_pass);
+    vkDestroyRenderPass(device_, render_pass, nullptr);
+
+    uploader.destroy();
+    registry.untrack(RESOURCE_COMMAND_POOL, cmd_pool);
+    vkDestroyCommandPool(device_, cmd_pool, nullptr);
+
+    // Buffers bound to pooled memory go before the allocator
+    registry.untrack(RESOURCE_BUFFER, indexBuf);
+    vkDestroyBuffer(device_, indexBuf, nullptr);
+    allocator.free(&indexAlloc);
+    registry.untrack(RESOURCE_BUFFER, vertex_buffer.buf);
+    vkDestroyBuffer(device_, vertex_buffer.buf, nullptr);
+    allocator.free(&vertex_buffer.alloc);
+    registry.untrack(RESOURCE_BUFFER, uniform_data.buf);
+    vkDestroyBuffer(device_, uniform_data.buf, nullptr);
+    allocator.free(&uniform_data.alloc);
+    allocator.destroy();
+
+    uint32_t leaked = registry.reportLive();
+    if (leaked) {
+        LOGE("%u objects leaked at teardown", leaked);
+    } else {
+        LOGI("all device resources released");
+    }
     vkDestroyDevice(device_, nullptr);
     vkDestroyInstance(instance_, nullptr);
 
@@ -64,43 +220,13 @@ void VulkanDevice::setReady() {
     initialized = true;
 }
 
-void VulkanDevice::initPipeLineLayout()
-{
-    VkDescriptorSetLayoutBinding layout_bindings{
-            .binding = 0,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-            .pImmutableSamplers = NULL,
-    };
-
-    /* Next take layout bindings and use them to create a descriptor set layout
-     */
-    VkDescriptorSetLayoutCreateInfo descriptor_layout{
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-            .pNext = NULL,
-            .bindingCount = 1,
-            .pBindings = &layout_bindings,
-    };
-
-    CALL_VK(vkCreateDescriptorSetLayout(device_, &descriptor_layout, NULL, &descLayout));
-
-    // Create pipeline layout (empty)
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-            .pNext = nullptr,
-            .setLayoutCount = 1, // ToDo
-            .pSetLayouts = &descLayout, // ToDo
-            .pushConstantRangeCount = 0,
-            .pPushConstantRanges = nullptr,
-    };
-    CALL_VK(vkCreatePipelineLayout(device_, &pipelineLayoutCreateInfo,
-                                   nullptr, &pipelineLayout));
-
+bool VulkanDevice::isHeadless() {
+    return headless;
 }
 
 VkResult VulkanDevice::loadShaderFromFile(const char *filePath, VkShaderModule *shaderOut) {
     // Read the file
+#ifdef __ANDROID__
     assert(androidAppCtx);
     AAsset* file = AAssetManager_open(androidAppCtx->activity->assetManager,
                                       filePath, AASSET_MODE_BUFFER);
@@ -109,6 +235,24 @@ VkResult VulkanDevice::loadShaderFromFile(const char *filePath, VkShaderModule *
     char* fileContent = new char[fileLength];
 
     AAsset_read(file, fileContent, fileLength);
+    AAsset_close(file);
+#else
+    // Headless builds load the SPIR-V relative to the working directory
+    FILE* file = fopen(filePath, "rb");
+    if (!file) {
+        LOGE("Cannot open %s", filePath);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t fileLength = ftell(file);
+    rewind(file);
+
+    char* fileContent = new char[fileLength];
+
+    size_t U_ASSERT_ONLY readLength = fread(fileContent, 1, fileLength, file);
+    assert(readLength == fileLength);
+    fclose(file);
+#endif
 
     VkShaderModuleCreateInfo shaderModuleCreateInfo{
             .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
@@ -119,65 +263,161 @@ VkResult VulkanDevice::loadShaderFromFile(const char *filePath, VkShaderModule *
     };
     VkResult result = vkCreateShaderModule(device_, &shaderModuleCreateInfo, nullptr, shaderOut);
     assert(result == VK_SUCCESS);
+    registry.track(RESOURCE_SHADER_MODULE, *shaderOut, filePath);
 
     delete[] fileContent;
 
     return result;
 }
 
-bool VulkanDevice::MapMemoryTypeToIndex(uint32_t typeBits, VkFlags requirements_mask, uint32_t *typeIndex) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(gpuDevice_, &memoryProperties);
-    // Search memtypes to find first index with those properties
-    for (uint32_t i = 0; i < 32; i++) {
-        if ((typeBits & 1) == 1) {
-            // Type is available, does it match user properties?
-            if ((memoryProperties.memoryTypes[i].propertyFlags &
-                 requirements_mask) == requirements_mask) {
-                *typeIndex = i;
-                return true;
-            }
-        }
-        typeBits >>= 1;
-    }
-
-    return false;
-}
-
 ////////
 void VulkanDevice::init()
 {
+    memset(&releasedTotals, 0, sizeof(releasedTotals));
     init_global_layer_properties();
     init_instance_extension_names();
     init_device_extension_names();
     init_instance("VulkanTeapot");
     init_enumerate_device(1);
-    init_swapchain_extension();
+    if (headless) {
+        init_headless_queue();
+    } else {
+        init_swapchain_extension();
+    }
     init_device();
+    allocator.init(gpuDevice_, device_, &registry);
 
-    const bool depthPresent = true;
-    init_swap_chain(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    depth.format = get_depth_format();
     init_command_pool();
-    init_command_buffer();
-    execute_begin_command_buffer();
     init_device_queue();
-    initSwapChainImages();
-    init_depth_buffer();
+    uploader.init(device_, &allocator, &registry, transfer_queue_,
+                  transfer_queue_family_index, queue_,
+                  graphics_queue_family_index);
     init_uniform_buffer();
-    init_descriptor_and_pipeline_layouts(depthPresent);
-    init_renderpass(depthPresent, true);
+    setObjectCount(objectCount);
+    init_descriptor_and_pipeline_layouts(kDepthPresent);
+    init_renderpass(kDepthPresent, true);
     init_shaders();
-    init_framebuffers(depthPresent);
-    initVertexBufferWithNormal(teapotPositions, sizeof(teapotPositions), teapotNormals, sizeof(teapotNormals));
-    initIndexForVertex(teapotIndices, sizeof(teapotIndices));
+    bool U_ASSERT_ONLY pass = initMesh(meshPath);
+    assert(pass);
+    // The first frame is submitted after the uploads on the same queue,
+    // the staging memory is released by later draws
+    uploader.flush();
     init_descriptor_pool(false);
     init_descriptor_set(false);
     init_pipeline_cache();
-    init_pipeline(depthPresent, true);
+    init_pipeline(kDepthPresent, true);
+
+    init_swap_chain_resources();
+    allocator.report();
+
+    initialized = true;
+}
+
+// Everything that depends on the surface: swapchain, image views, depth
+// buffer, framebuffers and the per-frame command buffers and sync objects.
+// The render pass and pipeline must already exist. Headless devices get
+// their offscreen color images here instead.
+void VulkanDevice::init_swap_chain_resources() {
+    if (headless) {
+        init_offscreen_images();
+    } else {
+        init_swap_chain(kSwapchainUsage);
+        initSwapChainImages();
+    }
+    init_depth_buffer();
+    init_framebuffers(kDepthPresent);
+    init_frame_resources();
+
+    updateProjection();
+    updateMVP();
+}
+
+// Called when the window goes away. Only the surface layer is destroyed,
+// the device and all GPU resources stay alive for a fast resume.
+void VulkanDevice::releaseSurface() {
+    if (surface_ == VK_NULL_HANDLE) {
+        return;
+    }
+    initialized = false;
+
+    vkDeviceWaitIdle(device_);
+    destroy_swap_chain_resources();
+    destroy_frame_resources();
+    registry.untrack(RESOURCE_SWAPCHAIN, swap_chain);
+    vkDestroySwapchainKHR(device_, swap_chain, NULL);
+    swap_chain = VK_NULL_HANDLE;
+    registry.untrack(RESOURCE_SURFACE, surface_);
+    vkDestroySurfaceKHR(instance_, surface_, NULL);
+    surface_ = VK_NULL_HANDLE;
+    window_ = nullptr;
+
+    LOGI("surface released");
+
+    // Every release should leave the same resources behind, anything more
+    // is leaking across background/foreground cycles
+    resource_totals totals;
+    registry.getTotals(&totals);
+    if (releasedTotals.liveCount &&
+        (totals.liveCount > releasedTotals.liveCount ||
+         totals.deviceMemoryBytes > releasedTotals.deviceMemoryBytes)) {
+        LOGE("resources grew since the last surface release: %u -> %u "
+             "objects, %.2f -> %.2f MiB device memory",
+             releasedTotals.liveCount, totals.liveCount,
+             releasedTotals.deviceMemoryBytes / (1024.0 * 1024.0),
+             totals.deviceMemoryBytes / (1024.0 * 1024.0));
+    }
+    releasedTotals = totals;
+    registry.report("surface released");
+}
+
+// Called when a new window is available after releaseSurface()
+bool VulkanDevice::attachSurface(ANativeWindow *window) {
+    if (headless) {
+        LOGE("A headless device cannot attach a surface");
+        return false;
+    }
+    double start = getTimeMs();
+
+    window_ = window;
+    if (!init_surface()) {
+        return false;
+    }
 
-    preDraw();
+    // The queue was chosen for the first surface, it has to be able to
+    // present to this one as well
+    VkBool32 supportsPresent = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(gpus[0], graphics_queue_family_index,
+                                         surface_, &supportsPresent);
+    if (supportsPresent != VK_TRUE) {
+        LOGE("Queue family %u cannot present to the new surface",
+             graphics_queue_family_index);
+        registry.untrack(RESOURCE_SURFACE, surface_);
+        vkDestroySurfaceKHR(instance_, surface_, NULL);
+        surface_ = VK_NULL_HANDLE;
+        return false;
+    }
+
+    // The render pass and the pipeline depend on the color format. It is
+    // the same in practice, rebuild them only if the surface changed it.
+    VkFormat surfaceFormat = get_surface_format();
+    if (surfaceFormat != format) {
+        LOGI("surface format changed %d -> %d", format, surfaceFormat);
+        format = surfaceFormat;
+        registry.untrack(RESOURCE_PIPELINE, pipeline);
+        vkDestroyPipeline(device_, pipeline, NULL);
+        registry.untrack(RESOURCE_RENDER_PASS, render_pass);
+        vkDestroyRenderPass(device_, render_pass, NULL);
+        init_renderpass(kDepthPresent, true);
+        init_pipeline(kDepthPresent, true);
+    }
 
+    init_swap_chain_resources();
     initialized = true;
+
+    LOGI("surface attached in %.2f ms", getTimeMs() - start);
+    registry.report("surface attached");
+    return true;
 }
 
 VkResult init_global_extension_properties(layer_properties &layer_props) {
@@ -258,18 +498,20 @@ VkResult VulkanDevice::init_global_layer_properties() {
 }
 
 void VulkanDevice::init_instance_extension_names() {
+    // Offscreen rendering needs no window system integration
+    if (headless) {
+        return;
+    }
     instance_extension_names.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #ifdef __ANDROID__
     instance_extension_names.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
-#elif defined(_WIN32)
-    instance_extension_names.push_back(
-        VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
-#else
-    instance_extension_names.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 #endif
 }
 
 void VulkanDevice::init_device_extension_names() {
+    if (headless) {
+        return;
+    }
     device_extension_names.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 }
 
@@ -327,22 +569,11 @@ VkResult VulkanDevice::init_enumerate_device(uint32_t gpu_count) {
     assert(queue_count >= 1);
 
     /* This is as good a place as any to do this */
-    vkGetPhysicalDeviceMemoryProperties(gpus[0], &memory_properties);
     vkGetPhysicalDeviceProperties(gpus[0], &gpu_props);
 
     return res;
 }
 
-void init_window_size(int32_t default_width,
-                      int32_t default_height) {
-#ifdef __ANDROID__
-    //AndroidGetWindowSize(&info.width, &info.height);
-#else
-    info.width = default_width;
-    info.height = default_height;
-#endif
-}
-
 #define GET_INSTANCE_PROC_ADDR(inst, entrypoint)                               \
     {                                                                          \
         fp##entrypoint =                                                  \
@@ -353,39 +584,36 @@ void init_window_size(int32_t default_width,
         }                                                                      \
     }
 
-bool VulkanDevice::init_swapchain_extension() {
+bool VulkanDevice::init_surface() {
     /* DEPENDS on init_connection() and init_window() */
 
     VkResult U_ASSERT_ONLY res;
 
 // Construct the surface description:
-#ifdef _WIN32
-    VkWin32SurfaceCreateInfoKHR createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-    createInfo.pNext = NULL;
-    createInfo.hinstance = info.connection;
-    createInfo.hwnd = info.window;
-    res = vkCreateWin32SurfaceKHR(info.inst, &createInfo,
-                                  NULL, &info.surface);
-#elif defined(__ANDROID__)
+#ifdef __ANDROID__
     GET_INSTANCE_PROC_ADDR(instance_, CreateAndroidSurfaceKHR);
 
     VkAndroidSurfaceCreateInfoKHR createInfo;
     createInfo.sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR;
     createInfo.pNext = nullptr;
     createInfo.flags = 0;
-    createInfo.window = androidAppCtx->window;
+    createInfo.window = window_;
     res = fpCreateAndroidSurfaceKHR(instance_, &createInfo, nullptr, &surface_);
-#else  // !__ANDROID__ && !_WIN32
-    VkXcbSurfaceCreateInfoKHR createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR;
-    createInfo.pNext = NULL;
-    createInfo.connection = info.connection;
-    createInfo.window = info.window;
-    res = vkCreateXcbSurfaceKHR(info.inst, &createInfo,
-                                NULL, &info.surface);
-#endif // __ANDROID__  && _WIN32
+#else  // !__ANDROID__
+    // Other platforms only run headless
+    LOGE("Window surfaces are not supported on this platform");
+    return false;
+#endif // __ANDROID__
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_SURFACE, surface_, "window");
+
+    return res == VK_SUCCESS;
+}
+
+bool VulkanDevice::init_swapchain_extension() {
+    if (!init_surface()) {
+        return false;
+    }
 
     // Iterate over each queue to learn whether it supports presenting:
     VkBool32 *supportsPresent =
@@ -417,6 +645,35 @@ bool VulkanDevice::init_swapchain_extension() {
 
     graphics_queue_family_index = graphicsQueueNodeIndex;
 
+    format = get_surface_format();
+
+    return true;
+}
+
+// Headless devices only need a graphics queue. Its images are never
+// presented, so any color format the pipeline can render to will do.
+bool VulkanDevice::init_headless_queue() {
+    graphics_queue_family_index = UINT32_MAX;
+    for (uint32_t i = 0; i < queue_count; i++) {
+        if ((queue_props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0) {
+            graphics_queue_family_index = i;
+            break;
+        }
+    }
+    if (graphics_queue_family_index == UINT32_MAX) {
+        LOGE("Could not find a graphics queue");
+        return false;
+    }
+
+    format = kHeadlessFormat;
+
+    return true;
+}
+
+VkFormat VulkanDevice::get_surface_format() {
+    VkResult U_ASSERT_ONLY res;
+    VkFormat surfaceFormat;
+
     // Get the list of VkFormats that are supported:
     uint32_t formatCount;
     res = vkGetPhysicalDeviceSurfaceFormatsKHR(gpus[0], surface_,
@@ -431,32 +688,62 @@ bool VulkanDevice::init_swapchain_extension() {
     // the surface has no preferred format.  Otherwise, at least one
     // supported format will be returned.
     if (formatCount == 1 && surfFormats[0].format == VK_FORMAT_UNDEFINED) {
-        format = VK_FORMAT_B8G8R8A8_UNORM;
+        surfaceFormat = VK_FORMAT_B8G8R8A8_UNORM;
     } else {
         assert(formatCount >= 1);
-        format = surfFormats[0].format;
+        surfaceFormat = surfFormats[0].format;
     }
+    free(surfFormats);
 
-    return true;
+    return surfaceFormat;
+}
+
+// A family with transfer but without graphics is usually a DMA engine that
+// copies alongside rendering. Families without compute either are the
+// purest copy queues. Falls back to the graphics family.
+uint32_t VulkanDevice::find_transfer_queue_family() {
+    uint32_t found = graphics_queue_family_index;
+    for (uint32_t i = 0; i < queue_count; i++) {
+        VkQueueFlags flags = queue_props[i].queueFlags;
+        if (!(flags & VK_QUEUE_TRANSFER_BIT) ||
+            (flags & VK_QUEUE_GRAPHICS_BIT)) {
+            continue;
+        }
+        if (!(flags & VK_QUEUE_COMPUTE_BIT)) {
+            return i;
+        }
+        if (found == graphics_queue_family_index) {
+            found = i;
+        }
+    }
+    return found;
 }
 
 VkResult VulkanDevice::init_device() {
     VkResult res;
 
+    transfer_queue_family_index = find_transfer_queue_family();
+
     float queue_priorities[1] = {0.0};
-    VkDeviceQueueCreateInfo queue_info{
+    VkDeviceQueueCreateInfo graphics_queue_info{
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             .pNext = NULL,
             .queueCount = 1,
             .pQueuePriorities = queue_priorities,
             .queueFamilyIndex = graphics_queue_family_index,
     };
+    // The transfer queue only gets its own entry for a separate family
+    VkDeviceQueueCreateInfo queue_info[2] = {graphics_queue_info,
+                                             graphics_queue_info};
+    queue_info[1].queueFamilyIndex = transfer_queue_family_index;
 
     VkDeviceCreateInfo device_info{
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
             .pNext = NULL,
-            .queueCreateInfoCount = 1,
-            .pQueueCreateInfos = &queue_info,
+            .queueCreateInfoCount =
+                    transfer_queue_family_index == graphics_queue_family_index
+                    ? 1u : 2u,
+            .pQueueCreateInfos = queue_info,
             .pEnabledFeatures = NULL,
     };
 
@@ -488,39 +775,7 @@ void VulkanDevice::init_command_pool() {
     res =
             vkCreateCommandPool(device_, &cmd_pool_info, NULL, &cmd_pool);
     assert(res == VK_SUCCESS);
-}
-
-void VulkanDevice::init_command_buffer() {
-    /* DEPENDS on init_swapchain_extension() and init_command_pool() */
-    VkResult U_ASSERT_ONLY res;
-
-    cmdBuffer = new VkCommandBuffer[swapchainImageCount];
-    VkCommandBufferAllocateInfo cmdBufInfo{
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .pNext = NULL,
-            .commandPool = cmd_pool,
-            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = swapchainImageCount,
-    };
-
-    res = vkAllocateCommandBuffers(device_, &cmdBufInfo, cmdBuffer);
-    assert(res == VK_SUCCESS);
-}
-
-void VulkanDevice::execute_begin_command_buffer() {
-    /* DEPENDS on init_command_buffer() */
-    VkResult U_ASSERT_ONLY res;
-
-    for (int i = 0; i < swapchainImageCount; i++) {
-        VkCommandBufferBeginInfo cmd_buf_info = {};
-        cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        cmd_buf_info.pNext = NULL;
-        cmd_buf_info.flags = 0;
-        cmd_buf_info.pInheritanceInfo = NULL;
-
-        res = vkBeginCommandBuffer(cmdBuffer[i], &cmd_buf_info);
-        assert(res == VK_SUCCESS);
-    }
+    registry.track(RESOURCE_COMMAND_POOL, cmd_pool, "graphics");
 }
 
 void VulkanDevice::init_device_queue() {
@@ -528,6 +783,8 @@ void VulkanDevice::init_device_queue() {
 
     vkGetDeviceQueue(device_, graphics_queue_family_index, 0,
                      &queue_);
+    vkGetDeviceQueue(device_, transfer_queue_family_index, 0,
+                     &transfer_queue_);
 }
 
 void VulkanDevice::init_swap_chain(VkImageUsageFlags usageFlags) {
@@ -558,33 +815,37 @@ void VulkanDevice::init_swap_chain(VkImageUsageFlags usageFlags) {
     width = swapChainExtent.width;
     height = swapChainExtent.height;
 
-    // If mailbox mode is available, use it, as is the lowest-latency non-
-    // tearing mode.  If not, try IMMEDIATE which will usually be available,
-    // and is fastest (though it tears).  If not, fall back to FIFO which is
-    // always available.
+    // Take the first present mode of the policy's preference list that the
+    // surface supports. FIFO is always available.
     VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-    for (size_t i = 0; i < presentModeCount; i++) {
-        if (presentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
-            swapchainPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-            break;
+    for (size_t p = 0; p < 3; p++) {
+        bool found = false;
+        for (size_t i = 0; i < presentModeCount; i++) {
+            if (presentModes[i] == kPolicyPresentModes[swapchainPolicy][p]) {
+                found = true;
+                break;
+            }
         }
-        if ((swapchainPresentMode != VK_PRESENT_MODE_MAILBOX_KHR) &&
-            (presentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR)) {
-            swapchainPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        if (found) {
+            swapchainPresentMode = kPolicyPresentModes[swapchainPolicy][p];
+            break;
         }
     }
-    LOGI("swapChainPresentMode = %d", swapchainPresentMode);
+    presentMode = swapchainPresentMode;
+    LOGI("swapChainPresentMode = %d (%s)", swapchainPresentMode,
+         kPolicyNames[swapchainPolicy]);
 
 #ifdef __ANDROID__
     // Current driver only support VK_PRESENT_MODE_FIFO_KHR.
     //swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
 #endif
 
-    // Determine the number of VkImage's to use in the swap chain (we desire to
-    // own only 1 image at a time, besides the images being displayed and
-    // queued for display):
+    // Determine the number of VkImage's to use in the swap chain. Lowest
+    // latency owns 1 image besides the ones being displayed and queued for
+    // display, power saver runs with the minimum and max throughput adds
+    // one more so rendering never waits for an image.
     uint32_t desiredNumberOfSwapChainImages =
-            surfCapabilities.minImageCount + 1;
+            surfCapabilities.minImageCount + kPolicyExtraImages[swapchainPolicy];
     if ((surfCapabilities.maxImageCount > 0) &&
         (desiredNumberOfSwapChainImages > surfCapabilities.maxImageCount)) {
         // Application must settle for fewer images than desired:
@@ -599,6 +860,10 @@ void VulkanDevice::init_swap_chain(VkImageUsageFlags usageFlags) {
         preTransform = surfCapabilities.currentTransform;
     }
 
+    // When recreating, hand the current swapchain to the driver so it can
+    // retire it cleanly and reuse its resources
+    VkSwapchainKHR oldSwapchain = swap_chain;
+
     LOGI("desiredNumberOfSwapChainImages = %u", desiredNumberOfSwapChainImages);
     VkSwapchainCreateInfoKHR swapChainInfo{
             .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
@@ -612,7 +877,7 @@ void VulkanDevice::init_swap_chain(VkImageUsageFlags usageFlags) {
             .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
             .imageArrayLayers = 1,
             .presentMode = swapchainPresentMode,
-            .oldSwapchain = VK_NULL_HANDLE,
+            .oldSwapchain = oldSwapchain,
 #ifndef __ANDROID__
             .clipped = true,
 #else
@@ -628,11 +893,22 @@ void VulkanDevice::init_swap_chain(VkImageUsageFlags usageFlags) {
     res =
             vkCreateSwapchainKHR(device_, &swapChainInfo, NULL, &swap_chain);
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_SWAPCHAIN, swap_chain, "swapchain");
+
+    if (oldSwapchain != VK_NULL_HANDLE) {
+        registry.untrack(RESOURCE_SWAPCHAIN, oldSwapchain);
+        vkDestroySwapchainKHR(device_, oldSwapchain, NULL);
+    }
 
     res = vkGetSwapchainImagesKHR(device_, swap_chain,
                                   &swapchainImageCount, NULL);
     assert(res == VK_SUCCESS);
 
+    // Measurements of the previous swapchain do not apply any more
+    lastFrameStart = 0.0;
+    policyFrames = 0;
+    policyIntervalSum = 0.0;
+
     if (NULL != presentModes) {
         free(presentModes);
     }
@@ -670,12 +946,11 @@ void VulkanDevice::initSwapChainImages() {
         color_image_view.flags = 0;
 
         sc_buffer.image = swapchainImages[i];
+        sc_buffer.alloc.memory = VK_NULL_HANDLE;
         LOGI("swapChainImage-1");
 
-        set_image_layout(i, sc_buffer.image, VK_IMAGE_ASPECT_COLOR_BIT,
-                         VK_IMAGE_LAYOUT_UNDEFINED,
-                         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-        LOGI("swapChainImage-2");
+        // Layout transitions are done by the render pass each frame, after
+        // the image acquired semaphore has been waited on.
 
         color_image_view.image = sc_buffer.image;
 
@@ -684,13 +959,100 @@ void VulkanDevice::initSwapChainImages() {
         LOGI("swapChainImage-2");
         buffers.push_back(sc_buffer);
         assert(res == VK_SUCCESS);
+        registry.track(RESOURCE_IMAGE_VIEW, sc_buffer.view, "swapchain");
     }
     free(swapchainImages);
     current_buffer = 0;
 
 }
 
-void VulkanDevice::set_image_layout(uint32_t cmdIndex, VkImage image,
+void VulkanDevice::init_offscreen_images() {
+    /* DEPENDS on init_device() and init_headless_queue() */
+    VkResult U_ASSERT_ONLY res;
+    bool U_ASSERT_ONLY pass;
+
+    // One color image per frame in flight plays the role of the swapchain
+    // images. The render pass leaves them in TRANSFER_SRC layout.
+    swapchainImageCount = framesInFlight;
+    if (swapchainImageCount < 1) {
+        swapchainImageCount = 1;
+    } else if (swapchainImageCount > MAX_FRAMES_IN_FLIGHT) {
+        swapchainImageCount = MAX_FRAMES_IN_FLIGHT;
+    }
+
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.pNext = NULL;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = format;
+    image_info.extent.width = width;
+    image_info.extent.height = height;
+    image_info.extent.depth = 1;
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = NUM_SAMPLES;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image_info.queueFamilyIndexCount = 0;
+    image_info.pQueueFamilyIndices = NULL;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.usage = kSwapchainUsage;
+    image_info.flags = 0;
+
+    VkImageViewCreateInfo color_image_view = {};
+    color_image_view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    color_image_view.pNext = NULL;
+    color_image_view.format = format;
+    color_image_view.components.r = VK_COMPONENT_SWIZZLE_R;
+    color_image_view.components.g = VK_COMPONENT_SWIZZLE_G;
+    color_image_view.components.b = VK_COMPONENT_SWIZZLE_B;
+    color_image_view.components.a = VK_COMPONENT_SWIZZLE_A;
+    color_image_view.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    color_image_view.subresourceRange.baseMipLevel = 0;
+    color_image_view.subresourceRange.levelCount = 1;
+    color_image_view.subresourceRange.baseArrayLayer = 0;
+    color_image_view.subresourceRange.layerCount = 1;
+    color_image_view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    color_image_view.flags = 0;
+
+    for (uint32_t i = 0; i < swapchainImageCount; i++) {
+        swap_chain_buffer sc_buffer;
+
+        res = vkCreateImage(device_, &image_info, NULL, &sc_buffer.image);
+        assert(res == VK_SUCCESS);
+
+        VkMemoryRequirements mem_reqs;
+        vkGetImageMemoryRequirements(device_, sc_buffer.image, &mem_reqs);
+
+        uint32_t memoryType;
+        pass = allocator.findMemoryType(mem_reqs.memoryTypeBits,
+                                        MEMORY_USAGE_GPU_ONLY, &memoryType);
+        assert(pass);
+
+        pass = allocator.allocate(mem_reqs, memoryType, true,
+                                  &sc_buffer.alloc);
+        assert(pass);
+        registry.track(RESOURCE_IMAGE, sc_buffer.image, "offscreen color",
+                       sc_buffer.alloc.size);
+        res = vkBindImageMemory(device_, sc_buffer.image,
+                                sc_buffer.alloc.memory,
+                                sc_buffer.alloc.offset);
+        assert(res == VK_SUCCESS);
+
+        color_image_view.image = sc_buffer.image;
+        res = vkCreateImageView(device_, &color_image_view, NULL,
+                                &sc_buffer.view);
+        assert(res == VK_SUCCESS);
+        registry.track(RESOURCE_IMAGE_VIEW, sc_buffer.view, "offscreen color");
+        buffers.push_back(sc_buffer);
+    }
+    current_buffer = 0;
+    lastRenderedBuffer = UINT32_MAX;
+
+    LOGI("offscreen images %u x %ux%u", swapchainImageCount, width, height);
+}
+
+void VulkanDevice::set_image_layout(VkCommandBuffer cmd, VkImage image,
                                     VkImageAspectFlags aspectMask,
                                     VkImageLayout old_image_layout,
                                     VkImageLayout new_image_layout) {
@@ -755,27 +1117,30 @@ void VulkanDevice::set_image_layout(uint32_t cmdIndex, VkImage image,
     VkPipelineStageFlags src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
     VkPipelineStageFlags dest_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
 
-    vkCmdPipelineBarrier(cmdBuffer[cmdIndex], src_stages, dest_stages, 0, 0, NULL, 0, NULL,
+    vkCmdPipelineBarrier(cmd, src_stages, dest_stages, 0, 0, NULL, 0, NULL,
                          1, &image_memory_barrier);
 }
 
-bool VulkanDevice::memory_type_from_properties(uint32_t typeBits,
-                                               VkFlags requirements_mask,
-                                               uint32_t *typeIndex) {
-    // Search memtypes to find first index with those properties
-    for (uint32_t i = 0; i < 32; i++) {
-        if ((typeBits & 1) == 1) {
-            // Type is available, does it match user properties?
-            if ((memory_properties.memoryTypes[i].propertyFlags &
-                 requirements_mask) == requirements_mask) {
-                *typeIndex = i;
-                return true;
-            }
+// First depth format the device can render to. Android drivers expose
+// D24S8, desktop and CPU implementations may only have D32S8 or plain depth.
+VkFormat VulkanDevice::get_depth_format() {
+    static const VkFormat candidates[] = {
+            VK_FORMAT_D24_UNORM_S8_UINT,
+            VK_FORMAT_D32_SFLOAT_S8_UINT,
+            VK_FORMAT_D16_UNORM_S8_UINT,
+            VK_FORMAT_D32_SFLOAT,
+            VK_FORMAT_D16_UNORM,
+    };
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(gpus[0], candidates[i], &props);
+        if (props.optimalTilingFeatures &
+            VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            return candidates[i];
         }
-        typeBits >>= 1;
     }
-    // No memory types matched, return failure
-    return false;
+    LOGE("No supported depth format");
+    return VK_FORMAT_UNDEFINED;
 }
 
 bool VulkanDevice::init_depth_buffer() {
@@ -783,25 +1148,17 @@ bool VulkanDevice::init_depth_buffer() {
     bool U_ASSERT_ONLY pass;
     VkImageCreateInfo image_info = {};
 
-    /* allow custom depth formats */
-    if (depth.format == VK_FORMAT_UNDEFINED) {
-        depth.format = VK_FORMAT_D16_UNORM;
-    }
-
-#ifdef __ANDROID__
-    // Depth format needs to be VK_FORMAT_D24_UNORM_S8_UINT on Android.
-    const VkFormat depth_format = VK_FORMAT_D24_UNORM_S8_UINT;
-#else
-    const VkFormat depth_format = info.depth.format;
-#endif
+    // Chosen once by get_depth_format(), the render pass is created from
+    // it and has to stay compatible across swapchain recreation
+    const VkFormat depth_format = depth.format;
     VkFormatProperties props;
     vkGetPhysicalDeviceFormatProperties(gpus[0], depth_format, &props);
-    if (props.linearTilingFeatures &
+    if (props.optimalTilingFeatures &
         VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
-        image_info.tiling = VK_IMAGE_TILING_LINEAR;
-    } else if (props.optimalTilingFeatures &
-               VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
         image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    } else if (props.linearTilingFeatures &
+               VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+        image_info.tiling = VK_IMAGE_TILING_LINEAR;
     } else {
         /* Try other depth formats? */
         //std::cout << "depth_format " << depth_format << " Unsupported.\n";
@@ -823,15 +1180,12 @@ bool VulkanDevice::init_depth_buffer() {
     image_info.queueFamilyIndexCount = 0;
     image_info.pQueueFamilyIndices = NULL;
     image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    // Depth only lives within the render pass, on tile-based GPUs it never
+    // has to leave tile memory and lazily allocated memory stays unbacked
+    image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                       VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
     image_info.flags = 0;
 
-    VkMemoryAllocateInfo mem_alloc = {};
-    mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    mem_alloc.pNext = NULL;
-    mem_alloc.allocationSize = 0;
-    mem_alloc.memoryTypeIndex = 0;
-
     VkImageViewCreateInfo view_info = {};
     view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     view_info.pNext = NULL;
@@ -863,67 +1217,81 @@ bool VulkanDevice::init_depth_buffer() {
 
     vkGetImageMemoryRequirements(device_, depth.image, &mem_reqs);
 
-    mem_alloc.allocationSize = mem_reqs.size;
     /* Use the memory properties to determine the type of memory required */
-    pass = memory_type_from_properties(mem_reqs.memoryTypeBits,
-                                       0, /* No requirements */
-                                       &mem_alloc.memoryTypeIndex);
+    uint32_t memoryType;
+    pass = allocator.findMemoryType(mem_reqs.memoryTypeBits,
+                                    MEMORY_USAGE_TRANSIENT_ATTACHMENT,
+                                    &memoryType);
     assert(pass);
 
     /* Allocate memory */
-    res = vkAllocateMemory(device_, &mem_alloc, NULL, &depth.mem);
-    assert(res == VK_SUCCESS);
+    pass = allocator.allocate(mem_reqs, memoryType,
+                              image_info.tiling == VK_IMAGE_TILING_OPTIMAL,
+                              &depth.alloc);
+    assert(pass);
+    registry.track(RESOURCE_IMAGE, depth.image, "depth", depth.alloc.size);
+    LOGI("depth %.2f MiB, %s", depth.alloc.size / (1024.0 * 1024.0),
+         (allocator.getMemoryTypeFlags(memoryType) &
+          VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) ? "lazily allocated"
+                                                   : "no lazy memory type");
 
     /* Bind memory */
-    res = vkBindImageMemory(device_, depth.image, depth.mem, 0);
+    res = vkBindImageMemory(device_, depth.image, depth.alloc.memory,
+                            depth.alloc.offset);
     assert(res == VK_SUCCESS);
 
-    /* Set the image layout to depth stencil optimal */
-    for (int i = 0; i < swapchainImageCount; i++) {
-        set_image_layout(i, depth.image,
-                         view_info.subresourceRange.aspectMask,
-                         VK_IMAGE_LAYOUT_UNDEFINED,
-                         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-    }
+    /* The render pass moves the image to depth stencil optimal layout */
 
     /* Create image view */
     view_info.image = depth.image;
     res = vkCreateImageView(device_, &view_info, NULL, &depth.view);
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_IMAGE_VIEW, depth.view, "depth");
 
     return true;
 }
 
-void VulkanDevice::init_uniform_buffer() {
-    VkResult U_ASSERT_ONLY res;
-    bool U_ASSERT_ONLY pass;
+void VulkanDevice::updateProjection() {
     float fov = glm::radians(45.0f);
     if (width > height) {
         fov *= static_cast<float>(height) / static_cast<float>(width);
     }
-    Projection = glm::perspective(fov,
+    transforms.setProjection(glm::perspective(fov,
                                        static_cast<float>(width) /
-                                       static_cast<float>(height), 0.1f, 300.0f);
-    View = glm::lookAt(
+                                       static_cast<float>(height), 0.1f, 300.0f));
+}
+
+void VulkanDevice::init_uniform_buffer() {
+    VkResult U_ASSERT_ONLY res;
+    bool U_ASSERT_ONLY pass;
+    updateProjection();
+    transforms.setView(glm::lookAt(
             glm::vec3(30, -200, 20), // Camera is at (5,3,10), in World Space
             glm::vec3(0, 0, 0),  // and looks at the origin
             glm::vec3(0, 0, 1)  // Head is up (set to 0,-1,0 to look upside-down)
-    );
-    Model = glm::mat4(1.0f);
+    ));
+    transforms.setModel(glm::mat4(1.0f));
     // Vulkan clip space has inverted Y and half Z.
-    Clip = glm::mat4(1.0f,  0.0f, 0.0f, 0.0f,
+    transforms.setClip(glm::mat4(1.0f,  0.0f, 0.0f, 0.0f,
                           0.0f, -1.0f, 0.0f, 0.0f,
                           0.0f,  0.0f, 0.5f, 0.0f,
-                          0.0f,  0.0f, 0.5f, 1.0f);
-
-    MVP = Clip * Projection * View * Model;
+                          0.0f,  0.0f, 0.5f, 1.0f));
 
     /* VULKAN_KEY_START */
+    // One arena region per possible frame in flight, large enough for
+    // MAX_OBJECTS transforms at minUniformBufferOffsetAlignment and rounded
+    // to whole atoms so each region can be flushed on its own
+    VkDeviceSize alignment = gpu_props.limits.minUniformBufferOffsetAlignment;
+    VkDeviceSize atomSize = gpu_props.limits.nonCoherentAtomSize;
+    VkDeviceSize objectStride = (sizeof(glm::mat4) + alignment - 1) & ~(alignment - 1);
+    VkDeviceSize frameSize = (objectStride * MAX_OBJECTS + atomSize - 1) &
+                             ~(atomSize - 1);
+
     VkBufferCreateInfo buf_info{
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
             .pNext = NULL,
             .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            .size = sizeof(MVP),
+            .size = frameSize * MAX_FRAMES_IN_FLIGHT,
             .queueFamilyIndexCount = 0,
             .pQueueFamilyIndices = NULL,
             .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
@@ -936,43 +1304,52 @@ void VulkanDevice::init_uniform_buffer() {
     vkGetBufferMemoryRequirements(device_, uniform_data.buf,
                                   &mem_reqs);
 
-    VkMemoryAllocateInfo alloc_info{
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .pNext = NULL,
-            .memoryTypeIndex = 0,
-    };
-
-    alloc_info.allocationSize = mem_reqs.size;
-    pass = memory_type_from_properties(mem_reqs.memoryTypeBits,
-                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                                       &alloc_info.memoryTypeIndex);
+    uint32_t memoryType;
+    pass = allocator.findMemoryType(mem_reqs.memoryTypeBits,
+                                    MEMORY_USAGE_CPU_TO_GPU, &memoryType);
     assert(pass);
+    // Coherent memory saves the flush, plain host visible memory works too
+    uniform_data.coherent = (allocator.getMemoryTypeFlags(memoryType) &
+                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    if (!uniform_data.coherent) {
+        // Flushed ranges are in atoms from the start of the memory object,
+        // the buffer has to start on one
+        if (mem_reqs.alignment < atomSize) {
+            mem_reqs.alignment = atomSize;
+        }
+    }
 
-    res = vkAllocateMemory(device_, &alloc_info, NULL,
-                           &(uniform_data.mem));
-    assert(res == VK_SUCCESS);
+    pass = allocator.allocate(mem_reqs, memoryType, false,
+                              &uniform_data.alloc);
+    assert(pass);
+    registry.track(RESOURCE_BUFFER, uniform_data.buf, "uniform arena",
+                   uniform_data.alloc.size);
 
-    uint8_t *pData;
-    res = vkMapMemory(device_, uniform_data.mem, 0, mem_reqs.size, 0,
-                      (void **)&pData);
+    res = vkBindBufferMemory(device_, uniform_data.buf,
+                             uniform_data.alloc.memory,
+                             uniform_data.alloc.offset);
     assert(res == VK_SUCCESS);
 
-    memcpy(pData, &MVP, sizeof(MVP));
-
-    vkUnmapMemory(device_, uniform_data.mem);
+    // The allocator keeps host visible memory mapped, updates are plain
+    // stores for the lifetime of the buffer
+    uniform_data.mapped = uniform_data.alloc.mapped;
 
-    res = vkBindBufferMemory(device_, uniform_data.buf, uniform_data.mem, 0);
-    assert(res == VK_SUCCESS);
+    uniformArena.init(uniform_data.mapped, frameSize, MAX_FRAMES_IN_FLIGHT,
+                      alignment, atomSize);
 
+    // The dynamic offset passed at bind time selects the object
     uniform_data.buffer_info.buffer = uniform_data.buf;
     uniform_data.buffer_info.offset = 0;
-    uniform_data.buffer_info.range = sizeof(MVP);
+    uniform_data.buffer_info.range = sizeof(glm::mat4);
+
+    LOGI("uniform arena %u x %u bytes, %s", MAX_FRAMES_IN_FLIGHT,
+         (uint32_t)frameSize, uniform_data.coherent ? "coherent" : "flushed");
 }
 
 void VulkanDevice::init_descriptor_and_pipeline_layouts(bool use_texture) {
     VkDescriptorSetLayoutBinding layout_bindings[2];
     layout_bindings[0].binding = 0;
-    layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     layout_bindings[0].descriptorCount = 1;
     layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     layout_bindings[0].pImmutableSamplers = NULL;
@@ -1001,6 +1378,7 @@ void VulkanDevice::init_descriptor_and_pipeline_layouts(bool use_texture) {
     res = vkCreateDescriptorSetLayout(device_, &descriptor_layout, NULL,
                                       desc_layout.data());
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_DESCRIPTOR_SET_LAYOUT, desc_layout[0], "shape");
 
     /* Now use the descriptor layout to create a pipeline layout */
     VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = {};
@@ -1012,8 +1390,21 @@ void VulkanDevice::init_descriptor_and_pipeline_layouts(bool use_texture) {
     pPipelineLayoutCreateInfo.setLayoutCount = NUM_DESCRIPTOR_SETS;
     pPipelineLayoutCreateInfo.pSetLayouts = desc_layout.data();
 
+    // The push constant path has no descriptors, only the 64 byte MVP
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(glm::mat4);
+    if (transformPath == TRANSFORM_PATH_PUSH_CONSTANTS) {
+        pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+        pPipelineLayoutCreateInfo.setLayoutCount = 0;
+        pPipelineLayoutCreateInfo.pSetLayouts = NULL;
+    }
+
     res = vkCreatePipelineLayout(device_, &pPipelineLayoutCreateInfo, NULL, &pipelineLayout);
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_PIPELINE_LAYOUT, pipelineLayout, "shape");
 }
 
 void VulkanDevice::init_renderpass(bool include_depth, bool clear) {
@@ -1029,8 +1420,10 @@ void VulkanDevice::init_renderpass(bool include_depth, bool clear) {
     attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // Headless frames are copied out instead of presented
+    attachments[0].finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                          : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     attachments[0].flags = 0;
 
     if (include_depth) {
@@ -1038,11 +1431,12 @@ void VulkanDevice::init_renderpass(bool include_depth, bool clear) {
         attachments[1].samples = NUM_SAMPLES;
         attachments[1].loadOp = clear ? VK_ATTACHMENT_LOAD_OP_CLEAR
                                       : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
-        attachments[1].initialLayout =
-                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        // Transient, nothing reads depth after the pass and stencil is
+        // unused, so none of it is written back to memory
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         attachments[1].finalLayout =
                 VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
         attachments[1].flags = 0;
@@ -1068,6 +1462,30 @@ void VulkanDevice::init_renderpass(bool include_depth, bool clear) {
     subpass.preserveAttachmentCount = 0;
     subpass.pPreserveAttachments = NULL;
 
+    VkSubpassDependency dependencies[2];
+    // The color attachment is written only after the swapchain image has
+    // been released by the presentation engine (image acquired semaphore
+    // is waited on at the color attachment output stage).
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dependencyFlags = 0;
+    // The depth buffer is shared by all frames in flight, so the previous
+    // frame's depth writes must finish before this frame clears it.
+    dependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].dstSubpass = 0;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                   VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                   VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dependencyFlags = 0;
+
     VkRenderPassCreateInfo rp_info = {};
     rp_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     rp_info.pNext = NULL;
@@ -1075,15 +1493,20 @@ void VulkanDevice::init_renderpass(bool include_depth, bool clear) {
     rp_info.pAttachments = attachments;
     rp_info.subpassCount = 1;
     rp_info.pSubpasses = &subpass;
-    rp_info.dependencyCount = 0;
-    rp_info.pDependencies = NULL;
+    rp_info.dependencyCount = include_depth ? 2 : 1;
+    rp_info.pDependencies = dependencies;
 
     res = vkCreateRenderPass(device_, &rp_info, NULL, &render_pass);
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_RENDER_PASS, render_pass, "shape");
 }
 
 void VulkanDevice::init_shaders() {
-    loadShaderFromFile("shaders/shape.vert.spv", &vertexShader);
+    if (transformPath == TRANSFORM_PATH_PUSH_CONSTANTS) {
+        loadShaderFromFile("shaders/shape_pc.vert.spv", &vertexShader);
+    } else {
+        loadShaderFromFile("shaders/shape.vert.spv", &vertexShader);
+    }
     loadShaderFromFile("shaders/shape.frag.spv", &fragmentShader);
 }
 
@@ -1115,206 +1538,217 @@ void VulkanDevice::init_framebuffers(bool include_depth) {
         res = vkCreateFramebuffer(device_, &fb_info, NULL,
                                   &framebuffers[i]);
         assert(res == VK_SUCCESS);
+        registry.track(RESOURCE_FRAMEBUFFER, framebuffers[i], "swapchain");
     }
 }
 
-void VulkanDevice::init_vertex_buffer(const void *vertexData,
-                                      uint32_t dataSize, uint32_t dataStride,
-                                      bool use_texture) {
+// Static geometry lives in DEVICE_LOCAL memory and is filled through the
+// staging uploader, the copy lands before the first frame that reads it
+void VulkanDevice::init_device_local_buffer(const char *name,
+                                            VkBufferUsageFlags usage,
+                                            const void *data,
+                                            VkDeviceSize size,
+                                            VkPipelineStageFlags dstStage,
+                                            VkAccessFlags dstAccess,
+                                            VkBuffer *buf,
+                                            gpu_allocation *alloc) {
     VkResult U_ASSERT_ONLY res;
     bool U_ASSERT_ONLY pass;
 
     VkBufferCreateInfo buf_info{
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
             .pNext = NULL,
-            .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            .size = dataSize,
+            .usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .size = size,
             .queueFamilyIndexCount = 0,
             .pQueueFamilyIndices = NULL,
             .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
             .flags = 0,
     };
-    res = vkCreateBuffer(device_, &buf_info, NULL, &vertex_buffer.buf);
+    res = vkCreateBuffer(device_, &buf_info, NULL, buf);
     assert(res == VK_SUCCESS);
 
     VkMemoryRequirements mem_reqs;
-    vkGetBufferMemoryRequirements(device_, vertex_buffer.buf,
-                                  &mem_reqs);
-
-    VkMemoryAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.pNext = NULL;
-    alloc_info.memoryTypeIndex = 0;
+    vkGetBufferMemoryRequirements(device_, *buf, &mem_reqs);
 
-    alloc_info.allocationSize = mem_reqs.size;
-    pass = memory_type_from_properties(mem_reqs.memoryTypeBits,
-                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                       &alloc_info.memoryTypeIndex);
+    uint32_t memoryType;
+    pass = allocator.findMemoryType(mem_reqs.memoryTypeBits,
+                                    MEMORY_USAGE_GPU_ONLY, &memoryType);
     assert(pass);
 
-    res = vkAllocateMemory(device_, &alloc_info, NULL,
-                           &(vertex_buffer.mem));
-    assert(res == VK_SUCCESS);
-    vertex_buffer.buffer_info.range = mem_reqs.size;
-    vertex_buffer.buffer_info.offset = 0;
-
-    uint8_t *pData;
-    res = vkMapMemory(device_, vertex_buffer.mem, 0, mem_reqs.size, 0,
-                      (void **)&pData);
-    assert(res == VK_SUCCESS);
-
-    memcpy(pData, vertexData, dataSize);
-
-    vkUnmapMemory(device_, vertex_buffer.mem);
-
-    res = vkBindBufferMemory(device_, vertex_buffer.buf, vertex_buffer.mem, 0);
-    assert(res == VK_SUCCESS);
-
-    vi_binding.binding = 0;
-    vi_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    vi_binding.stride = dataStride;
-
-    vi_attribs[0].binding = 0;
-    vi_attribs[0].location = 0;
-    vi_attribs[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    vi_attribs[0].offset = 0;
-    vi_attribs[1].binding = 0;
-    vi_attribs[1].location = 1;
-    vi_attribs[1].format =
-            use_texture ? VK_FORMAT_R32G32_SFLOAT : VK_FORMAT_R32G32B32A32_SFLOAT;
-    vi_attribs[1].offset = 16;
-}
-
-void VulkanDevice::initVertexBufferWithNormal(const float *vertexData,
-                                              uint32_t vertexDataSize, const float *normalData, uint32_t normalDataSize) {
-    VkResult U_ASSERT_ONLY res;
-    bool U_ASSERT_ONLY pass;
-
-    uint32_t dataSize = vertexDataSize + normalDataSize;
-    VkBufferCreateInfo buf_info{
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .pNext = NULL,
-            .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            .size = dataSize,
-            .queueFamilyIndexCount = 0,
-            .pQueueFamilyIndices = NULL,
-            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-            .flags = 0,
-    };
-    res = vkCreateBuffer(device_, &buf_info, NULL, &vertex_buffer.buf);
-    assert(res == VK_SUCCESS);
-
-    VkMemoryRequirements mem_reqs;
-    vkGetBufferMemoryRequirements(device_, vertex_buffer.buf,
-                                  &mem_reqs);
-
-    VkMemoryAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.pNext = NULL;
-    alloc_info.memoryTypeIndex = 0;
-
-    alloc_info.allocationSize = mem_reqs.size;
-    pass = memory_type_from_properties(mem_reqs.memoryTypeBits,
-                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                       &alloc_info.memoryTypeIndex);
+    pass = allocator.allocate(mem_reqs, memoryType, false, alloc);
     assert(pass);
-
-    res = vkAllocateMemory(device_, &alloc_info, NULL,
-                           &(vertex_buffer.mem));
+    registry.track(RESOURCE_BUFFER, *buf, name, alloc->size);
+    res = vkBindBufferMemory(device_, *buf, alloc->memory, alloc->offset);
     assert(res == VK_SUCCESS);
-    vertex_buffer.buffer_info.range = mem_reqs.size;
-    vertex_buffer.buffer_info.offset = 0;
 
-    uint8_t *pData;
-    res = vkMapMemory(device_, vertex_buffer.mem, 0, mem_reqs.size, 0,
-                      (void **)&pData);
-    assert(res == VK_SUCCESS);
+    pass = uploader.uploadBuffer(*buf, 0, data, size, dstStage, dstAccess);
+    assert(pass);
+}
 
-    const float *vData = vertexData;
-    const float *nData = normalData;
-    float *vBuf = (float *)pData;
-    uint32_t elementNum = vertexDataSize / (sizeof(float) * 3);
-    for (int i = 0; i < elementNum; i++) {
-        // vertex
-        *vBuf++ = *vData++;
-        *vBuf++ = *vData++;
-        *vBuf++ = *vData++;
-        // normal
-        *vBuf++ = *nData++;
-        *vBuf++ = *nData++;
-        *vBuf++ = *nData++;
+// The bindings of a layout are stored back to back in vertex_buffer.
+// Attribute semantics are the vertex shader input locations, the ones the
+// shaders do not read stay in the strides but are not bound.
+void VulkanDevice::init_vertex_input(const vertex_layout *layout,
+                                     size_t vertexCount) {
+    vi_bindings.clear();
+    vi_attribs.clear();
+    vertex_offsets.clear();
+    VkDeviceSize offset = 0;
+    for (uint32_t b = 0; b < layout->bindingCount; b++) {
+        VkVertexInputBindingDescription binding;
+        binding.binding = b;
+        binding.stride = layout->strides[b];
+        binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        vi_bindings.push_back(binding);
+        vertex_offsets.push_back(offset);
+        offset += (VkDeviceSize)layout->strides[b] * vertexCount;
+    }
+    for (uint32_t i = 0; i < layout->attributeCount; i++) {
+        const vertex_layout_attribute &attribute = layout->attributes[i];
+        if (!(kShaderSemantics & 1u << attribute.semantic)) {
+            continue;
+        }
+        VkVertexInputAttributeDescription description;
+        description.location = attribute.semantic;
+        description.binding = attribute.binding;
+        description.format = kMeshFormats[attribute.format];
+        description.offset = attribute.offset;
+        vi_attribs.push_back(description);
     }
-
-    vkUnmapMemory(device_, vertex_buffer.mem);
-
-    res = vkBindBufferMemory(device_, vertex_buffer.buf, vertex_buffer.mem, 0);
-    assert(res == VK_SUCCESS);
-
-    vi_binding.binding = 0;
-    vi_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    vi_binding.stride = sizeof(float) * 6;
-
-    vi_attribs[0].binding = 0;
-    vi_attribs[0].location = 0;
-    vi_attribs[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    vi_attribs[0].offset = 0;
-    vi_attribs[1].binding = 0;
-    vi_attribs[1].location = 1;
-    vi_attribs[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    vi_attribs[1].offset = 12;
 }
 
-void VulkanDevice::initIndexForVertex(const uint16_t *indexData, size_t indexDataSize) {
-    // Create a vertex buffer
-    uint32_t queueIdx = 0;
-    VkBufferCreateInfo createBufferInfo{
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .pNext = nullptr,
-            .size = indexDataSize,
-            .usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-            .flags = 0,
-            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-            .pQueueFamilyIndices = &queueIdx,
-            .queueFamilyIndexCount = 1,
-    };
-    CALL_VK(vkCreateBuffer(device_, &createBufferInfo, nullptr, &indexBuf));
-
-    VkMemoryRequirements memReq;
-    vkGetBufferMemoryRequirements(device_, indexBuf, &memReq);
+// Vertices and indices of meshes optimized by meshconv go from the mapped
+// file straight into staging memory, nothing is converted on the device.
+// Other meshes go through the same passes here first. The file can be
+// closed once the uploads are queued.
+bool VulkanDevice::initMesh(const char *path) {
+    MeshFile mesh;
+#ifdef __ANDROID__
+    AAssetManager *assets = androidAppCtx->activity->assetManager;
+#else
+    AAssetManager *assets = nullptr;
+#endif
+    if (!mesh.open(assets, path)) {
+        return false;
+    }
+    const mesh_file_header &header = mesh.getHeader();
 
-    VkMemoryAllocateInfo allocInfo {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .pNext = nullptr,
-            .allocationSize = indexDataSize,
-            .memoryTypeIndex = 0,  // Memory type assigned in the next step
+    // Both are inputs of the vertex shaders
+    const mesh_file_attribute *attributes[2] = {
+            mesh.getAttribute(MESH_ATTRIBUTE_POSITION),
+            mesh.getAttribute(MESH_ATTRIBUTE_NORMAL),
     };
+    if (!attributes[0] || !attributes[1]) {
+        LOGE("%s lacks positions or normals", path);
+        return false;
+    }
 
-    // Assign the proper memory type for that buffer
-    allocInfo.allocationSize = memReq.size;
-    bool U_ASSERT_ONLY pass;
-    pass = memory_type_from_properties(memReq.memoryTypeBits,
-                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                       &allocInfo.memoryTypeIndex);
-    assert(pass);
-
-    // Allocate memory for the buffer
-    VkDeviceMemory deviceMemory;
-    CALL_VK(vkAllocateMemory(device_, &allocInfo, nullptr, &deviceMemory));
-
-    void* data;
-    CALL_VK(vkMapMemory(device_, deviceMemory, 0, indexDataSize, 0, &data));
-    memcpy(data, indexData, indexDataSize);
-    vkUnmapMemory(device_, deviceMemory);
-
-    CALL_VK(vkBindBufferMemory(device_, indexBuf, deviceMemory, 0));
+    // The processed copies are uploaded instead of the mapping
+    const void *vertices = mesh.getVertices();
+    const void *indices = mesh.getIndices();
+    size_t vertexCount = header.vertexCount;
+    size_t indexCount = header.indexCount;
+    uint32_t indexSize = header.indexSize;
+    std::vector<uint8_t> compacted;
+    std::vector<uint32_t> order(indexCount);
+    std::vector<uint16_t> order16;
+    mesh.decodeIndices(order.data());
+    const uint32_t optimizedFlags = MESH_FILE_FLAG_TRIANGLES_OPTIMIZED |
+                                    MESH_FILE_FLAG_VERTICES_COMPACTED;
+    if ((header.flags & optimizedFlags) == optimizedFlags) {
+        vertex_cache_stats stats = analyzeVertexCache(
+                order.data(), indexCount, vertexCount,
+                VERTEX_CACHE_REPORT_SIZE);
+        LOGI("%s: optimized offline, ACMR %.3f, ATVR %.3f", path,
+             stats.acmr, stats.atvr);
+    } else {
+        double start = getTimeMs();
+        compacted.assign((const uint8_t *)vertices,
+                         (const uint8_t *)vertices + mesh.getVertexBytes());
+        std::vector<float> positions(vertexCount * 3);
+        mesh.decodePositions(positions.data());
+        mesh_optimize_stats stats;
+        optimizeMesh(compacted.data(), header.vertexStride, &vertexCount,
+                     order.data(), &indexCount, positions.data(),
+                     !(header.flags & MESH_FILE_FLAG_TRIANGLES_OPTIMIZED),
+                     &stats);
+        if (!indexCount) {
+            LOGE("%s has only degenerate triangles", path);
+            return false;
+        }
+        indexSize = vertexCount <= 0x10000 ? 2 : 4;
+        LOGI("%s: optimized in %.2f ms, vertices %zu -> %zu, triangles "
+             "%zu -> %zu, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", path,
+             getTimeMs() - start, stats.vertexCountBefore,
+             stats.vertexCountAfter, stats.triangleCountBefore,
+             stats.triangleCountAfter, stats.cacheBefore.acmr,
+             stats.cacheAfter.acmr, stats.cacheBefore.atvr,
+             stats.cacheAfter.atvr);
+        LOGI("%s: vertex and index bytes %zu -> %zu", path,
+             mesh.getVertexBytes() + mesh.getIndexBytes(),
+             vertexCount * header.vertexStride + indexCount * indexSize);
+        vertices = compacted.data();
+        if (indexSize == 2) {
+            order16.assign(order.begin(), order.begin() + indexCount);
+            indices = order16.data();
+        } else {
+            indices = order.data();
+        }
+    }
+    size_t vertexBytes = vertexCount * header.vertexStride;
+
+    init_device_local_buffer("vertex", VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                             vertices, vertexBytes,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+                             &vertex_buffer.buf, &vertex_buffer.alloc);
+    vertex_buffer.buffer_info.range = vertexBytes;
+    vertex_buffer.buffer_info.offset = 0;
 
-    drawElementNum = indexDataSize / sizeof(uint16_t);
-    drawInstanceNum = drawElementNum / 3;
+    vertex_layout layout;
+    initVertexLayout(&layout, header, mesh.getAttributes());
+    init_vertex_input(&layout, vertexCount);
+
+    // Position decode is affine, it costs nothing once it is part of the
+    // model matrix. Normals are only normalized by the fragment shader,
+    // the non uniform scale never reaches them.
+    meshDequantize = glm::scale(
+            glm::translate(glm::mat4(1.0f),
+                           glm::vec3(header.positionBias[0],
+                                     header.positionBias[1],
+                                     header.positionBias[2])),
+            glm::vec3(header.positionScale[0], header.positionScale[1],
+                      header.positionScale[2]));
+    transforms.setModel(meshDequantize);
+    switch (attributes[1]->format) {
+        case MESH_FORMAT_UNORM10X3:
+            normalDecode = NORMAL_DECODE_UNORM;
+            break;
+        case MESH_FORMAT_OCT_SNORM16X2:
+            normalDecode = NORMAL_DECODE_OCTAHEDRAL;
+            break;
+        default:
+            normalDecode = NORMAL_DECODE_NONE;
+            break;
+    }
 
-    LOGI("drawElementNum=%zu", drawElementNum);
+    init_device_local_buffer("index", VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                             indices, indexCount * indexSize,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             VK_ACCESS_INDEX_READ_BIT, &indexBuf, &indexAlloc);
+    indexType = indexSize == 4 ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+
+    drawElementNum = indexCount;
+    // The shaders ignore the instance index, extra instances would only
+    // draw the same teapot again
+    drawInstanceNum = 1;
+
+    LOGI("drawElementNum=%zu, bounds (%.1f %.1f %.1f) - (%.1f %.1f %.1f)",
+         drawElementNum, header.boundsMin[0], header.boundsMin[1],
+         header.boundsMin[2], header.boundsMax[0], header.boundsMax[1],
+         header.boundsMax[2]);
+    return true;
 }
 
 void VulkanDevice::init_descriptor_pool(bool use_texture) {
@@ -1323,8 +1757,10 @@ void VulkanDevice::init_descriptor_pool(bool use_texture) {
 
     VkResult U_ASSERT_ONLY res;
     VkDescriptorPoolSize type_count[2];
-    type_count[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    type_count[0].descriptorCount = 1;
+    // A single set serves every object, dynamic offsets select the
+    // transform per draw
+    type_count[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    type_count[0].descriptorCount = NUM_DESCRIPTOR_SETS;
     if (use_texture) {
         type_count[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         type_count[1].descriptorCount = 1;
@@ -1333,13 +1769,14 @@ void VulkanDevice::init_descriptor_pool(bool use_texture) {
     VkDescriptorPoolCreateInfo descriptor_pool = {};
     descriptor_pool.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descriptor_pool.pNext = NULL;
-    descriptor_pool.maxSets = 1;
+    descriptor_pool.maxSets = NUM_DESCRIPTOR_SETS;
     descriptor_pool.poolSizeCount = use_texture ? 2 : 1;
     descriptor_pool.pPoolSizes = type_count;
 
     res = vkCreateDescriptorPool(device_, &descriptor_pool, NULL,
                                  &desc_pool);
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_DESCRIPTOR_POOL, desc_pool, "shape");
 }
 
 void VulkanDevice::init_descriptor_set(bool use_texture) {
@@ -1366,7 +1803,7 @@ void VulkanDevice::init_descriptor_set(bool use_texture) {
     writes[0].pNext = NULL;
     writes[0].dstSet = desc_set[0];
     writes[0].descriptorCount = 1;
-    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     writes[0].pBufferInfo = &uniform_data.buffer_info;
     writes[0].dstArrayElement = 0;
     writes[0].dstBinding = 0;
@@ -1398,12 +1835,14 @@ void VulkanDevice::init_pipeline_cache() {
     res = vkCreatePipelineCache(device_, &pipelineCacheInfo, NULL,
                                 &pipelineCache);
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_PIPELINE_CACHE, pipelineCache, "shape");
 }
 
 void VulkanDevice::init_pipeline(VkBool32 include_depth, VkBool32 include_vi) {
     VkResult U_ASSERT_ONLY res;
 
-    VkDynamicState dynamicStateEnables[VK_DYNAMIC_STATE_RANGE_SIZE];
+    // Viewport and scissor
+    VkDynamicState dynamicStateEnables[2];
     VkPipelineDynamicStateCreateInfo dynamicState = {};
     memset(dynamicStateEnables, 0, sizeof dynamicStateEnables);
     dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
@@ -1417,10 +1856,10 @@ void VulkanDevice::init_pipeline(VkBool32 include_depth, VkBool32 include_vi) {
     if (include_vi) {
         vi.pNext = NULL;
         vi.flags = 0;
-        vi.vertexBindingDescriptionCount = 1;
-        vi.pVertexBindingDescriptions = &vi_binding;
-        vi.vertexAttributeDescriptionCount = 2;
-        vi.pVertexAttributeDescriptions = vi_attribs;
+        vi.vertexBindingDescriptionCount = (uint32_t)vi_bindings.size();
+        vi.pVertexBindingDescriptions = vi_bindings.data();
+        vi.vertexAttributeDescriptionCount = (uint32_t)vi_attribs.size();
+        vi.pVertexAttributeDescriptions = vi_attribs.data();
     }
     VkPipelineInputAssemblyStateCreateInfo ia{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
@@ -1471,7 +1910,8 @@ void VulkanDevice::init_pipeline(VkBool32 include_depth, VkBool32 include_vi) {
     vp.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     vp.pNext = NULL;
     vp.flags = 0;
-#ifndef __ANDROID__
+    // Viewport and scissor are dynamic so the pipeline survives swapchain
+    // recreation with a different extent
     vp.viewportCount = NUM_VIEWPORTS;
     dynamicStateEnables[dynamicState.dynamicStateCount++] =
         VK_DYNAMIC_STATE_VIEWPORT;
@@ -1480,26 +1920,6 @@ void VulkanDevice::init_pipeline(VkBool32 include_depth, VkBool32 include_vi) {
         VK_DYNAMIC_STATE_SCISSOR;
     vp.pScissors = NULL;
     vp.pViewports = NULL;
-#else
-    // Temporary disabling dynamic viewport on Android because some of drivers doesn't
-    // support the feature.
-    VkViewport viewports;
-    viewports.minDepth = 0.0f;
-    viewports.maxDepth = 1.0f;
-    viewports.x = 0;
-    viewports.y = 0;
-    viewports.width = width;
-    viewports.height = height;
-    VkRect2D scissor;
-    scissor.extent.width = width;
-    scissor.extent.height = height;
-    scissor.offset.x = 0;
-    scissor.offset.y = 0;
-    vp.viewportCount = NUM_VIEWPORTS;
-    vp.scissorCount = NUM_SCISSORS;
-    vp.pScissors = &scissor;
-    vp.pViewports = &viewports;
-#endif
     VkPipelineDepthStencilStateCreateInfo ds;
     ds.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
     ds.pNext = NULL;
@@ -1532,6 +1952,17 @@ void VulkanDevice::init_pipeline(VkBool32 include_depth, VkBool32 include_vi) {
     ms.alphaToOneEnable = VK_FALSE;
     ms.minSampleShading = 0.0;
 
+    // The vertex shaders decode normals in the mesh's format
+    VkSpecializationMapEntry specializationEntry = {};
+    specializationEntry.constantID = 0;
+    specializationEntry.offset = 0;
+    specializationEntry.size = sizeof(normalDecode);
+    VkSpecializationInfo specialization = {};
+    specialization.mapEntryCount = 1;
+    specialization.pMapEntries = &specializationEntry;
+    specialization.dataSize = sizeof(normalDecode);
+    specialization.pData = &normalDecode;
+
     // Specify vertex and fragment shader stages
     VkPipelineShaderStageCreateInfo shaderStages[2] {
             {
@@ -1539,7 +1970,7 @@ void VulkanDevice::init_pipeline(VkBool32 include_depth, VkBool32 include_vi) {
                     .pNext = nullptr,
                     .stage = VK_SHADER_STAGE_VERTEX_BIT,
                     .module = vertexShader,
-                    .pSpecializationInfo = nullptr,
+                    .pSpecializationInfo = &specialization,
                     .flags = 0,
                     .pName = "main",
             },
@@ -1579,37 +2010,12 @@ void VulkanDevice::init_pipeline(VkBool32 include_depth, VkBool32 include_vi) {
     res = vkCreateGraphicsPipelines(device_, pipelineCache, 1,
                                     &pipelineInfo, NULL, &pipeline);
     assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_PIPELINE, pipeline, "shape");
 }
 
-void init_viewports() {
-#ifdef __ANDROID__
-    // Disable dynamic viewport on Android. Some drive has an issue with the dynamic viewport
-    // feature.
-#else
-    info.viewport.height = (float)info.height;
-    info.viewport.width = (float)info.width;
-    info.viewport.minDepth = (float)0.0f;
-    info.viewport.maxDepth = (float)1.0f;
-    info.viewport.x = 0;
-    info.viewport.y = 0;
-    vkCmdSetViewport(info.cmd, 0, NUM_VIEWPORTS, &info.viewport);
-#endif
-}
-
-void init_scissors() {
-#ifdef __ANDROID__
-    // Disable dynamic viewport on Android. Some drive has an issue with the dynamic scissors
-    // feature.
-#else
-    info.scissor.extent.width = info.width;
-    info.scissor.extent.height = info.height;
-    info.scissor.offset.x = 0;
-    info.scissor.offset.y = 0;
-    vkCmdSetScissor(info.cmd, 0, NUM_SCISSORS, &info.scissor);
-#endif
-}
-
-void VulkanDevice::preDraw() {
+// Commands of one frame. Recorded every frame into the frame's own command
+// buffer, so the dynamic offsets can select the frame's uniform slice.
+void VulkanDevice::recordCommandBuffer(VkCommandBuffer cmd, uint32_t imageIndex) {
     VkClearValue clear_values[2];
     clear_values[0].color.float32[0] = 0.2f;
     clear_values[0].color.float32[1] = 0.2f;
@@ -1618,177 +2024,654 @@ void VulkanDevice::preDraw() {
     clear_values[1].depthStencil.depth = 1.0f;
     clear_values[1].depthStencil.stencil = 0;
 
-    VkSemaphoreCreateInfo presentCompleteSemaphoreCreateInfo;
-    presentCompleteSemaphoreCreateInfo.sType =
-            VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    presentCompleteSemaphoreCreateInfo.pNext = NULL;
-    presentCompleteSemaphoreCreateInfo.flags = 0;
+    // The pool allows individual resets, beginning implicitly resets the
+    // buffer the previous use of this frame slot recorded
+    VkCommandBufferBeginInfo cmd_buf_info = {};
+    cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmd_buf_info.pNext = NULL;
+    cmd_buf_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    cmd_buf_info.pInheritanceInfo = NULL;
+    CALL_VK(vkBeginCommandBuffer(cmd, &cmd_buf_info));
+
+    VkRenderPassBeginInfo rp_begin{
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .pNext = NULL,
+            .renderPass = render_pass,
+            .framebuffer = framebuffers[imageIndex],
+            .renderArea.offset.x = 0,
+            .renderArea.offset.y = 0,
+            .renderArea.extent.width = width,
+            .renderArea.extent.height = height,
+            .clearValueCount = 2,
+            .pClearValues = clear_values,
+    };
+
+    vkCmdBeginRenderPass(cmd, &rp_begin, VK_SUBPASS_CONTENTS_INLINE);
 
-    VkResult res = vkCreateSemaphore(device_, &presentCompleteSemaphoreCreateInfo,
-                            NULL, &presentCompleteSemaphore);
-    assert(res == VK_SUCCESS);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
-    // Get the index of the next available swapchain image:
-    res = vkAcquireNextImageKHR(device_, swap_chain, UINT64_MAX,
-                                presentCompleteSemaphore, VK_NULL_HANDLE,
-                                &current_buffer);
-    // TODO: Deal with the VK_SUBOPTIMAL_KHR and VK_ERROR_OUT_OF_DATE_KHR
-    // return codes
-    assert(res == VK_SUCCESS);
+    VkBuffer vertexBuffers[VERTEX_LAYOUT_MAX_BINDINGS];
+    for (size_t b = 0; b < vi_bindings.size(); b++) {
+        vertexBuffers[b] = vertex_buffer.buf;
+    }
+    vkCmdBindVertexBuffers(cmd, 0, (uint32_t)vi_bindings.size(),
+                           vertexBuffers, vertex_offsets.data());
+    vkCmdBindIndexBuffer(cmd, indexBuf, 0, indexType);
+
+    VkViewport viewport{
+            .x = 0,
+            .y = 0,
+            .width = (float)width,
+            .height = (float)height,
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f,
+    };
+    vkCmdSetViewport(cmd, 0, NUM_VIEWPORTS, &viewport);
+
+    VkRect2D scissor{
+            .offset.x = 0,
+            .offset.y = 0,
+            .extent.width = width,
+            .extent.height = height,
+    };
+    vkCmdSetScissor(cmd, 0, NUM_SCISSORS, &scissor);
+
+    for (uint32_t i = 0; i < objectCount; i++) {
+        if (transformPath == TRANSFORM_PATH_PUSH_CONSTANTS) {
+            vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                               0, sizeof(glm::mat4),
+                               &transforms.getObjectMVP(i));
+        } else {
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    pipelineLayout, 0, NUM_DESCRIPTOR_SETS,
+                                    desc_set.data(), 1, &objectOffsets[i]);
+        }
+        vkCmdDrawIndexed(cmd, drawElementNum, drawInstanceNum, 0, 0, 0);
+    }
+    vkCmdEndRenderPass(cmd);
+
+    // The render pass leaves the image in PRESENT_SRC_KHR layout, or
+    // TRANSFER_SRC_OPTIMAL when headless
+    CALL_VK(vkEndCommandBuffer(cmd));
+}
+
+// Sub-allocate every object's transform from this frame's arena region.
+// The frame fence has been waited on, so the GPU no longer reads it.
+void VulkanDevice::writeUniforms(uint32_t frameIndex) {
+    // Push constants are recorded straight into the command buffer
+    if (transformPath == TRANSFORM_PATH_PUSH_CONSTANTS) {
+        return;
+    }
+
+    // The transforms are computed straight into mapped memory, one batch
+    // for all objects
+    uniformArena.beginFrame(frameIndex);
+    void *data;
+    uint32_t stride;
+    uint32_t offset = uniformArena.allocateArray(sizeof(glm::mat4),
+                                                 objectCount, &stride, &data);
+    // The arena is sized for MAX_OBJECTS
+    assert(offset != UINT32_MAX);
+    transforms.writeObjectMVPs(data, stride);
+    for (uint32_t i = 0; i < objectCount; i++) {
+        objectOffsets[i] = offset + i * stride;
+    }
 
-    for (int i = 0; i < swapchainImageCount; i++) {
-        VkRenderPassBeginInfo rp_begin{
-                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-                .pNext = NULL,
-                .renderPass = render_pass,
-                .framebuffer = framebuffers[i],
-                .renderArea.offset.x = 0,
-                .renderArea.offset.y = 0,
-                .renderArea.extent.width = width,
-                .renderArea.extent.height = height,
-                .clearValueCount = 2,
-                .pClearValues = clear_values,
-        };
-
-        vkCmdBeginRenderPass(cmdBuffer[i], &rp_begin, VK_SUBPASS_CONTENTS_INLINE);
-
-        vkCmdBindPipeline(cmdBuffer[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-        vkCmdBindDescriptorSets(cmdBuffer[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                pipelineLayout, 0, NUM_DESCRIPTOR_SETS,
-                                desc_set.data(), 0, NULL);
-
-        const VkDeviceSize offsets[1] = {0};
-        vkCmdBindVertexBuffers(cmdBuffer[i], 0, 1, &vertex_buffer.buf, offsets);
-        vkCmdBindIndexBuffer(cmdBuffer[i], indexBuf, offsets[0], VK_INDEX_TYPE_UINT16);
-
-        //init_viewports(info);
-        //init_scissors(info);
-
-        //vkCmdDraw(cmdBuffer[i], 12 * 3, 1, 0, 0);
-        vkCmdDrawIndexed(cmdBuffer[i], drawElementNum, drawInstanceNum, 0, 0, 0);
-        vkCmdEndRenderPass(cmdBuffer[i]);
-
-        VkImageMemoryBarrier prePresentBarrier {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                .pNext = NULL,
-                .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
-                .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-                .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .subresourceRange.baseMipLevel = 0,
-                .subresourceRange.levelCount = 1,
-                .subresourceRange.baseArrayLayer = 0,
-                .subresourceRange.layerCount = 1,
-                .image = buffers[i].image,
-        };
-        vkCmdPipelineBarrier(cmdBuffer[i], VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0,
-                             NULL, 1, &prePresentBarrier);
-
-        res = vkEndCommandBuffer(cmdBuffer[i]);
-    }
-    //const VkCommandBuffer cmd_bufs[] = {cmd};
+    if (!uniform_data.coherent) {
+        VkMappedMemoryRange range = {};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.pNext = NULL;
+        range.memory = uniform_data.alloc.memory;
+        uniformArena.getWrittenRange(&range.offset, &range.size);
+        range.offset += uniform_data.alloc.offset;
+        CALL_VK(vkFlushMappedMemoryRanges(device_, 1, &range));
+    }
+}
+
+void VulkanDevice::init_frame_resources() {
+    if (framesInFlight < 1) {
+        framesInFlight = 1;
+    } else if (framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+        framesInFlight = MAX_FRAMES_IN_FLIGHT;
+    }
+
+    VkSemaphoreCreateInfo semaphoreInfo{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+    };
+    // Fences start signaled so the first use of each slot does not block
     VkFenceCreateInfo fenceInfo{
             .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
             .pNext = NULL,
-            .flags = 0,
+            .flags = VK_FENCE_CREATE_SIGNALED_BIT,
     };
-    vkCreateFence(device_, &fenceInfo, NULL, &drawFence);
-
-    VkPipelineStageFlags pipe_stage_flags =
-            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-    VkSubmitInfo submit_info[1] = {};
-    submit_info[0].pNext = NULL;
-    submit_info[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info[0].waitSemaphoreCount = 1;
-    submit_info[0].pWaitSemaphores = &presentCompleteSemaphore;
-    submit_info[0].pWaitDstStageMask = &pipe_stage_flags;
-    submit_info[0].commandBufferCount = 1;
-    submit_info[0].pCommandBuffers = &cmdBuffer[current_buffer],
-    submit_info[0].signalSemaphoreCount = 0;
-    submit_info[0].pSignalSemaphores = NULL;
-
-    /* Queue the command buffer for execution */
-    res = vkQueueSubmit(queue_, 1, submit_info, drawFence);
-    assert(res == VK_SUCCESS);
 
-    /* Now present the image in the window */
+    VkCommandBufferAllocateInfo cmdBufInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext = NULL,
+            .commandPool = cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+    };
 
-    present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    present.pNext = NULL;
-    present.swapchainCount = 1;
-    present.pSwapchains = &swap_chain;
-    present.pImageIndices = &current_buffer;
-    present.pWaitSemaphores = NULL;
-    present.waitSemaphoreCount = 0;
-    present.pResults = NULL;
+    frames.resize(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        CALL_VK(vkAllocateCommandBuffers(device_, &cmdBufInfo,
+                                         &frames[i].cmdBuffer));
+        CALL_VK(vkCreateFence(device_, &fenceInfo, NULL, &frames[i].fence));
+        CALL_VK(vkCreateSemaphore(device_, &semaphoreInfo, NULL,
+                                  &frames[i].imageAcquiredSemaphore));
+        CALL_VK(vkCreateSemaphore(device_, &semaphoreInfo, NULL,
+                                  &frames[i].renderCompleteSemaphore));
+        registry.track(RESOURCE_COMMAND_BUFFER, frames[i].cmdBuffer, "frame");
+        registry.track(RESOURCE_FENCE, frames[i].fence, "frame");
+        registry.track(RESOURCE_SEMAPHORE, frames[i].imageAcquiredSemaphore,
+                       "image acquired");
+        registry.track(RESOURCE_SEMAPHORE, frames[i].renderCompleteSemaphore,
+                       "render complete");
+    }
+    imagesInFlight.assign(swapchainImageCount, VK_NULL_HANDLE);
+    currentFrame = 0;
 
-    //
-    /* Make sure command buffer is finished before presenting */
-    do {
-        res = vkWaitForFences(device_, 1, &drawFence, VK_TRUE, FENCE_TIMEOUT);
-        LOGI("draw %d", res);
-    } while (res == VK_TIMEOUT);
-    assert(res == VK_SUCCESS);
-    res = vkQueuePresentKHR(queue_, &present);
-    assert(res == VK_SUCCESS);
+    LOGI("framesInFlight = %u", framesInFlight);
+}
 
-    LOGI("preDraw");
-    //
+void VulkanDevice::destroy_frame_resources() {
+    for (size_t i = 0; i < frames.size(); i++) {
+        registry.untrack(RESOURCE_COMMAND_BUFFER, frames[i].cmdBuffer);
+        registry.untrack(RESOURCE_FENCE, frames[i].fence);
+        registry.untrack(RESOURCE_SEMAPHORE, frames[i].imageAcquiredSemaphore);
+        registry.untrack(RESOURCE_SEMAPHORE, frames[i].renderCompleteSemaphore);
+        vkFreeCommandBuffers(device_, cmd_pool, 1, &frames[i].cmdBuffer);
+        vkDestroyFence(device_, frames[i].fence, NULL);
+        vkDestroySemaphore(device_, frames[i].imageAcquiredSemaphore, NULL);
+        vkDestroySemaphore(device_, frames[i].renderCompleteSemaphore, NULL);
+    }
+    frames.clear();
+    imagesInFlight.clear();
+}
+
+uint32_t VulkanDevice::getFramesInFlight() {
+    return framesInFlight;
 }
 
 VkResult VulkanDevice::draw() {
+    uploader.retire();
+    if (headless) {
+        return drawHeadless();
+    }
+
     VkResult res;
+    frame_resources &frame = frames[currentFrame];
+
+    double frameStart = getTimeMs();
+    if (lastFrameStart > 0.0 && frameStart - lastFrameStart < MAX_FRAME_INTERVAL) {
+        policyIntervalSum += frameStart - lastFrameStart;
+        policyFrames++;
+        if (policyFrames == POLICY_REPORT_FRAMES) {
+            reportSwapchainPolicy();
+        }
+    }
+    lastFrameStart = frameStart;
+
+    // Wait until the GPU has retired the last frame that used this slot.
+    // With more than one frame in flight this normally returns immediately.
+    double waitStart = getTimeMs();
+    do {
+        res = vkWaitForFences(device_, 1, &frame.fence, VK_TRUE, FENCE_TIMEOUT);
+    } while (res == VK_TIMEOUT);
+    assert(res == VK_SUCCESS);
+    double waitEnd = getTimeMs();
+    double fenceWait = waitEnd - waitStart;
 
     // Get the framebuffer index we should draw in
-    CALL_VK(vkAcquireNextImageKHR(device_, swap_chain,
-                                  UINT64_MAX, presentCompleteSemaphore,
-                                  VK_NULL_HANDLE, &current_buffer));
-    CALL_VK(vkResetFences(device_, 1, &drawFence));
-    VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    res = vkAcquireNextImageKHR(device_, swap_chain,
+                                UINT64_MAX, frame.imageAcquiredSemaphore,
+                                VK_NULL_HANDLE, &current_buffer);
+    double acquireEnd = getTimeMs();
+    frameStats.record(FRAME_STAT_ACQUIRE, waitEnd, acquireEnd);
+    if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+        // Nothing was acquired, the semaphore stays unsignaled
+        recreateSwapchain();
+        return res;
+    }
+    // A suboptimal image is still presentable, recreate after this frame
+    assert(res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR);
+    bool suboptimal = (res == VK_SUBOPTIMAL_KHR);
+
+    // An image acquired out of order may still be rendered by an older
+    // frame, never let two frames in flight write the same image
+    VkFence imageFence = imagesInFlight[current_buffer];
+    if (imageFence != VK_NULL_HANDLE && imageFence != frame.fence) {
+        do {
+            res = vkWaitForFences(device_, 1, &imageFence, VK_TRUE, FENCE_TIMEOUT);
+        } while (res == VK_TIMEOUT);
+        assert(res == VK_SUCCESS);
+    }
+    imagesInFlight[current_buffer] = frame.fence;
+    double submitStart = getTimeMs();
+    fenceWait += submitStart - acquireEnd;
+    frameStats.record(FRAME_STAT_FENCE_WAIT, submitStart - fenceWait, submitStart);
+    fenceWaitTime += fenceWait;
+
+    writeUniforms(currentFrame);
+    recordCommandBuffer(frame.cmdBuffer, current_buffer);
+
+    CALL_VK(vkResetFences(device_, 1, &frame.fence));
+    // Only color attachment output has to wait for the acquired image,
+    // vertex work can start before the presentation engine releases it
+    VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     VkSubmitInfo submit_info = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
             .pNext = nullptr,
             .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &presentCompleteSemaphore,
+            .pWaitSemaphores = &frame.imageAcquiredSemaphore,
             .pWaitDstStageMask = &pipe_stage_flags,
             .commandBufferCount = 1,
-            .pCommandBuffers = &cmdBuffer[current_buffer],
+            .pCommandBuffers = &frame.cmdBuffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &frame.renderCompleteSemaphore,
+    };
+    CALL_VK(vkQueueSubmit(queue_, 1, &submit_info, frame.fence));
+    double presentStart = getTimeMs();
+    frameStats.record(FRAME_STAT_SUBMIT, submitStart, presentStart);
+
+    // Presentation is ordered after rendering on the GPU, the CPU moves on
+    // to the next frame right away
+    VkPresentInfoKHR presentInfo{
+            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .pNext = NULL,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &frame.renderCompleteSemaphore,
+            .swapchainCount = 1,
+            .pSwapchains = &swap_chain,
+            .pImageIndices = &current_buffer,
+            .pResults = NULL,
+    };
+    res = vkQueuePresentKHR(queue_, &presentInfo);
+    double presentEnd = getTimeMs();
+    frameStats.record(FRAME_STAT_PRESENT, presentStart, presentEnd);
+    frameStats.record(FRAME_STAT_CPU_FRAME, frameStart, presentEnd);
+
+    currentFrame = (currentFrame + 1) % framesInFlight;
+
+    if (suboptimal || res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR) {
+        recreateSwapchain();
+        // The frame went to the old images, the caller has to draw again
+        if (res == VK_SUCCESS) {
+            res = VK_SUBOPTIMAL_KHR;
+        }
+    } else {
+        assert(res == VK_SUCCESS);
+    }
+
+    return res;
+}
+
+// Headless frames go round robin through the offscreen images. Nothing is
+// acquired or presented, the frame fence alone paces the CPU.
+VkResult VulkanDevice::drawHeadless() {
+    VkResult res;
+    frame_resources &frame = frames[currentFrame];
+
+    double waitStart = getTimeMs();
+    do {
+        res = vkWaitForFences(device_, 1, &frame.fence, VK_TRUE, FENCE_TIMEOUT);
+    } while (res == VK_TIMEOUT);
+    assert(res == VK_SUCCESS);
+
+    current_buffer = (current_buffer + 1) % swapchainImageCount;
+    VkFence imageFence = imagesInFlight[current_buffer];
+    if (imageFence != VK_NULL_HANDLE && imageFence != frame.fence) {
+        do {
+            res = vkWaitForFences(device_, 1, &imageFence, VK_TRUE, FENCE_TIMEOUT);
+        } while (res == VK_TIMEOUT);
+        assert(res == VK_SUCCESS);
+    }
+    imagesInFlight[current_buffer] = frame.fence;
+    double submitStart = getTimeMs();
+    frameStats.record(FRAME_STAT_FENCE_WAIT, waitStart, submitStart);
+    fenceWaitTime += submitStart - waitStart;
+
+    writeUniforms(currentFrame);
+    recordCommandBuffer(frame.cmdBuffer, current_buffer);
+
+    CALL_VK(vkResetFences(device_, 1, &frame.fence));
+    VkSubmitInfo submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = nullptr,
+            .waitSemaphoreCount = 0,
+            .pWaitSemaphores = nullptr,
+            .pWaitDstStageMask = nullptr,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &frame.cmdBuffer,
             .signalSemaphoreCount = 0,
-            .pSignalSemaphores = nullptr
+            .pSignalSemaphores = nullptr,
     };
+    CALL_VK(vkQueueSubmit(queue_, 1, &submit_info, frame.fence));
+    double submitEnd = getTimeMs();
+    frameStats.record(FRAME_STAT_SUBMIT, submitStart, submitEnd);
+    frameStats.record(FRAME_STAT_CPU_FRAME, waitStart, submitEnd);
 
-    CALL_VK(vkQueueSubmit(queue_, 1, &submit_info, drawFence));
-    //do {
-        res = vkWaitForFences(device_, 1, &drawFence, VK_TRUE, FENCE_TIMEOUT);
-    //} while(res == VK_TIMEOUT);
+    lastRenderedBuffer = current_buffer;
+    currentFrame = (currentFrame + 1) % framesInFlight;
 
-    present.pImageIndices = &current_buffer;
-    vkQueuePresentKHR(queue_, &present);
+    return VK_SUCCESS;
+}
 
-    return res;
+// Copy the newest headless frame to host memory as tightly packed RGBA8
+bool VulkanDevice::readPixels(std::vector<uint8_t> &rgba) {
+    if (!headless || lastRenderedBuffer == UINT32_MAX) {
+        return false;
+    }
+    VkResult U_ASSERT_ONLY res;
+    bool U_ASSERT_ONLY pass;
+
+    VkDeviceSize size = (VkDeviceSize)width * height * 4;
+    VkBufferCreateInfo buf_info{
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .pNext = NULL,
+            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .size = size,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = NULL,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .flags = 0,
+    };
+    VkBuffer readback;
+    res = vkCreateBuffer(device_, &buf_info, NULL, &readback);
+    assert(res == VK_SUCCESS);
+
+    VkMemoryRequirements mem_reqs;
+    vkGetBufferMemoryRequirements(device_, readback, &mem_reqs);
+
+    uint32_t memoryType;
+    pass = allocator.findMemoryType(mem_reqs.memoryTypeBits,
+                                    MEMORY_USAGE_READBACK, &memoryType);
+    assert(pass);
+
+    gpu_allocation readbackAlloc;
+    pass = allocator.allocate(mem_reqs, memoryType, false, &readbackAlloc);
+    assert(pass);
+    registry.track(RESOURCE_BUFFER, readback, "readback", readbackAlloc.size);
+    res = vkBindBufferMemory(device_, readback, readbackAlloc.memory,
+                             readbackAlloc.offset);
+    assert(res == VK_SUCCESS);
+
+    VkCommandBufferAllocateInfo cmdBufInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext = NULL,
+            .commandPool = cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+    };
+    VkCommandBuffer cmd;
+    res = vkAllocateCommandBuffers(device_, &cmdBufInfo, &cmd);
+    assert(res == VK_SUCCESS);
+    registry.track(RESOURCE_COMMAND_BUFFER, cmd, "readback");
+
+    VkCommandBufferBeginInfo cmd_buf_info = {};
+    cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmd_buf_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    res = vkBeginCommandBuffer(cmd, &cmd_buf_info);
+    assert(res == VK_SUCCESS);
+
+    // The render pass already moved the image to TRANSFER_SRC, only the
+    // color writes have to be made visible to the copy
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = buffers[lastRenderedBuffer].image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL,
+                         1, &barrier);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = width;
+    region.imageExtent.height = height;
+    region.imageExtent.depth = 1;
+    vkCmdCopyImageToBuffer(cmd, buffers[lastRenderedBuffer].image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback, 1,
+                           &region);
+
+    VkBufferMemoryBarrier hostBarrier = {};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = readback;
+    hostBarrier.offset = 0;
+    hostBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1,
+                         &hostBarrier, 0, NULL);
+
+    res = vkEndCommandBuffer(cmd);
+    assert(res == VK_SUCCESS);
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd;
+    CALL_VK(vkQueueSubmit(queue_, 1, &submit_info, VK_NULL_HANDLE));
+    CALL_VK(vkQueueWaitIdle(queue_));
+
+    uint8_t *pData = readbackAlloc.mapped;
+    rgba.assign(pData, pData + size);
+
+    registry.untrack(RESOURCE_COMMAND_BUFFER, cmd);
+    vkFreeCommandBuffers(device_, cmd_pool, 1, &cmd);
+    registry.untrack(RESOURCE_BUFFER, readback);
+    vkDestroyBuffer(device_, readback, NULL);
+    allocator.free(&readbackAlloc);
+
+    return true;
+}
+
+double VulkanDevice::measureFrameTime(uint32_t frameNum, double *fenceWait) {
+    vkDeviceWaitIdle(device_);
+    fenceWaitTime = 0.0;
+
+    double start = getTimeMs();
+    for (uint32_t i = 0; i < frameNum; i++) {
+        draw();
+    }
+    vkDeviceWaitIdle(device_);
+    double elapsed = getTimeMs() - start;
+
+    if (fenceWait) {
+        *fenceWait = fenceWaitTime / frameNum;
+    }
+    return elapsed / frameNum;
+}
+
+bool VulkanDevice::getFrameStats(FrameStatType type,
+                                 frame_stat_summary *summary) {
+    return frameStats.getSummary(type, summary);
+}
+
+void VulkanDevice::reportFrameStats() {
+    frameStats.report();
+}
+
+void VulkanDevice::getMemoryStats(gpu_memory_stats *stats) {
+    allocator.getStats(stats);
+}
+
+void VulkanDevice::reportMemoryStats() {
+    allocator.report();
+}
+
+void VulkanDevice::getResourceTotals(resource_totals *totals) {
+    registry.getTotals(totals);
+}
+
+void VulkanDevice::reportResources(const char *when) {
+    registry.report(when);
+}
+
+void VulkanDevice::setSwapchainPolicy(SwapchainPolicy policy) {
+    if (policy == swapchainPolicy) {
+        return;
+    }
+    swapchainPolicy = policy;
+    if (isReady()) {
+        recreateSwapchain();
+    }
+}
+
+SwapchainPolicy VulkanDevice::getSwapchainPolicy() {
+    return swapchainPolicy;
+}
+
+bool VulkanDevice::getSwapchainPolicyStats(swapchain_policy_stats *stats) {
+    stats->policy = swapchainPolicy;
+    stats->presentMode = presentMode;
+    stats->imageCount = swapchainImageCount;
+    if (policyFrames == 0) {
+        return false;
+    }
+
+    stats->frameInterval = (float)(policyIntervalSum / policyFrames);
+    stats->framesPerSecond = 1000.0f / stats->frameInterval;
+    // Without display timing feedback the latency is estimated from the
+    // queue depth: with FIFO every frame we are allowed to queue ahead
+    // waits one more refresh, mailbox and immediate show the newest frame.
+    uint32_t queued = 0;
+    if (presentMode == VK_PRESENT_MODE_FIFO_KHR) {
+        queued = swapchainImageCount - 1;
+        if (queued > framesInFlight) {
+            queued = framesInFlight;
+        }
+    }
+    stats->estimatedLatency = stats->frameInterval * (queued + 1);
+    return true;
+}
+
+void VulkanDevice::reportSwapchainPolicy() {
+    swapchain_policy_stats stats;
+    if (!getSwapchainPolicyStats(&stats)) {
+        return;
+    }
+    LOGI("swapchain policy %s: present mode %d, %u images, "
+         "%.2f ms/frame (%.1f fps), estimated latency %.1f ms",
+         kPolicyNames[stats.policy], stats.presentMode, stats.imageCount,
+         stats.frameInterval, stats.framesPerSecond, stats.estimatedLatency);
+    policyFrames = 0;
+    policyIntervalSum = 0.0;
+}
+
+void VulkanDevice::destroy_swap_chain_resources() {
+    for (uint32_t i = 0; i < swapchainImageCount; i++) {
+        registry.untrack(RESOURCE_FRAMEBUFFER, framebuffers[i]);
+        vkDestroyFramebuffer(device_, framebuffers[i], NULL);
+    }
+    free(framebuffers);
+
+    registry.untrack(RESOURCE_IMAGE_VIEW, depth.view);
+    vkDestroyImageView(device_, depth.view, NULL);
+    registry.untrack(RESOURCE_IMAGE, depth.image);
+    vkDestroyImage(device_, depth.image, NULL);
+    allocator.free(&depth.alloc);
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        registry.untrack(RESOURCE_IMAGE_VIEW, buffers[i].view);
+        vkDestroyImageView(device_, buffers[i].view, NULL);
+        // Swapchain images belong to the swapchain, offscreen ones to us
+        if (buffers[i].alloc.memory != VK_NULL_HANDLE) {
+            registry.untrack(RESOURCE_IMAGE, buffers[i].image);
+            vkDestroyImage(device_, buffers[i].image, NULL);
+            allocator.free(&buffers[i].alloc);
+        }
+    }
+    buffers.clear();
+}
+
+// Rebuild only what depends on the surface size: swapchain, image views,
+// depth buffer, framebuffers and the command buffers that reference them.
+// Instance, device, pipeline, buffers and pipeline cache are kept.
+void VulkanDevice::recreateSwapchain() {
+    double start = getTimeMs();
+
+    // Frames in flight still reference the old images and framebuffers
+    vkDeviceWaitIdle(device_);
+    destroy_swap_chain_resources();
+    // A failed present may leave a semaphore signaled, start over cleanly
+    destroy_frame_resources();
+
+    init_swap_chain_resources();
+
+    LOGI("swapchain recreated %ux%u in %.2f ms", width, height,
+         getTimeMs() - start);
 }
 
 void VulkanDevice::rotateModel(float x, float y, float z) {
-    LOGI("rotate y = %f", y);
-    Model = glm::rotate(glm::mat4(1.0f), glm::radians(y), glm::vec3(0, 0, 1));
+    transforms.setModel(
+            glm::rotate(glm::mat4(1.0f), glm::radians(y), glm::vec3(0, 0, 1)) *
+            meshDequantize);
     updateMVP();
 }
 
+// The GPU may still read the uniform slices of frames in flight, the new
+// transforms reach the next frame's slice in draw(). Only the products
+// whose inputs changed since the last call are recomputed.
 void VulkanDevice::updateMVP() {
-    MVP = Clip * Projection * View * Model;
+    transforms.update();
+}
 
-    uint8_t *pData;
-    VkResult res = vkMapMemory(device_, uniform_data.mem, 0, sizeof(MVP), 0, (void **)&pData);
-    assert(res == VK_SUCCESS);
+// Lay num teapots out on a square grid in the XZ plane, scaled down so the
+// grid takes the space of the single teapot
+void VulkanDevice::setObjectCount(uint32_t num) {
+    if (num < 1) {
+        num = 1;
+    } else if (num > MAX_OBJECTS) {
+        num = MAX_OBJECTS;
+    }
+    objectCount = num;
 
-    memcpy(pData, &MVP, sizeof(MVP));
+    uint32_t columns = 1;
+    while (columns * columns < num) {
+        columns++;
+    }
+    float scale = 1.0f / columns;
+    float spacing = 100.0f * scale;
+
+    std::vector<glm::mat4> objectPlacement(num);
+    objectOffsets.resize(num);
+    for (uint32_t i = 0; i < num; i++) {
+        float x = ((i % columns) - (columns - 1) * 0.5f) * spacing;
+        float z = ((i / columns) - (columns - 1) * 0.5f) * spacing;
+        objectPlacement[i] =
+                glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(x, 0, z)),
+                           glm::vec3(scale));
+    }
+    transforms.setObjectPlacement(objectPlacement);
+    updateMVP();
+}
 
-    vkUnmapMemory(device_, uniform_data.mem);
+uint32_t VulkanDevice::getObjectCount() {
+    return objectCount;
 }
 
-void destroy(struct sample_info &info) {
+TransformPath VulkanDevice::getTransformPath() {
+    return transformPath;
 }
@@ -19,13 +19,60 @@
 
 #include <vector>
 
+#ifdef __ANDROID__
 #include "vulkan_wrapper.h"
+#else
+#include <vulkan/vulkan.h>
+#endif
 #include "glm/glm.hpp"
+#include "FrameStats.h"
+#include "GpuAllocator.h"
+#include "StagingUploader.h"
+#include "UniformArena.h"
+#include "TransformState.h"
+#include "VertexPacker.h"
 
 struct android_app;
+struct ANativeWindow;
+
+/* Number of frames the CPU may queue ahead of the GPU.              */
+/* 1 serializes CPU and GPU work, 2 or 3 lets them overlap.          */
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 3
+
+/* Upper limit of setObjectCount(), sizes the per-frame uniform arena   */
+#define MAX_OBJECTS 4096
+
+/* Mesh drawn unless another one is given, see MeshFile.h. Headless     */
+/* builds run from app/src/main, Android reads it from the APK assets.  */
+#ifdef __ANDROID__
+#define DEFAULT_MESH_PATH "teapot.mesh"
+#else
+#define DEFAULT_MESH_PATH "assets/teapot.mesh"
+#endif
 
 enum ShaderType { VERTEX_SHADER, FRAGMENT_SHADER };
 
+/*
+ * How the per-draw transform reaches the vertex shader. Chosen when the
+ * device is created, the pipeline layout and vertex shader depend on it.
+ */
+enum TransformPath {
+    TRANSFORM_PATH_UNIFORM_BUFFER,  // uniform arena, dynamic offset per draw
+    TRANSFORM_PATH_PUSH_CONSTANTS,  // vkCmdPushConstants per draw, shape_pc.vert
+};
+
+/*
+ * Trade-off between latency, throughput and power used to pick the present
+ * mode and the number of swapchain images. Can be changed at runtime.
+ */
+enum SwapchainPolicy {
+    SWAPCHAIN_POLICY_LOWEST_LATENCY,  // mailbox > immediate > FIFO, min + 1 images
+    SWAPCHAIN_POLICY_POWER_SAVER,     // FIFO, minimum number of images
+    SWAPCHAIN_POLICY_MAX_THROUGHPUT,  // immediate > mailbox > FIFO, min + 2 images
+    SWAPCHAIN_POLICY_NUM
+};
+
 /*
  * A layer can expose extensions, keep track of those
  * extensions here.
@@ -37,26 +84,82 @@ typedef struct {
 
 /*
  * Keep each of our swap chain buffers' image, command buffer and view in one
- * spot
+ * spot. Headless devices own their color images, alloc.memory is
+ * VK_NULL_HANDLE for swapchain images.
  */
 typedef struct _swap_chain_buffers {
     VkImage image;
+    gpu_allocation alloc;
     VkImageView view;
 } swap_chain_buffer;
 
+/*
+ * What the current swapchain policy achieves. Times are in milliseconds.
+ */
+typedef struct _swapchain_policy_stats {
+    SwapchainPolicy policy;
+    VkPresentModeKHR presentMode;
+    uint32_t imageCount;
+    float frameInterval;
+    float framesPerSecond;
+    float estimatedLatency;
+} swapchain_policy_stats;
+
+/*
+ * Command buffer and synchronization objects owned by one frame in flight.
+ * The CPU may record and submit a frame while the GPU is still rendering the
+ * previous ones; the fence tells us when this slot can be reused.
+ */
+typedef struct _frame_resources {
+    VkCommandBuffer cmdBuffer;
+    VkFence fence;
+    VkSemaphore imageAcquiredSemaphore;
+    VkSemaphore renderCompleteSemaphore;
+} frame_resources;
+
 class VulkanDevice {
 public:
-    VulkanDevice(android_app *app);
+    VulkanDevice(android_app *app, ANativeWindow *window,
+                 uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT,
+                 TransformPath transformPath = TRANSFORM_PATH_UNIFORM_BUFFER,
+                 const char *meshPath = DEFAULT_MESH_PATH);
+    // Headless: renders into device-owned images, no surface or swapchain
+    VulkanDevice(uint32_t width, uint32_t height,
+                 uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT,
+                 TransformPath transformPath = TRANSFORM_PATH_UNIFORM_BUFFER,
+                 const char *meshPath = DEFAULT_MESH_PATH);
     ~VulkanDevice();
 
     bool isReady();
+    bool isHeadless();
     void setReady();
-    void initPipeLineLayout();
     VkResult loadShaderFromFile(const char* filePath, VkShaderModule* shaderOut);
-    bool MapMemoryTypeToIndex(uint32_t typeBits, VkFlags requirements_mask, uint32_t *typeIndex);
+    // VK_SUCCESS once the frame is presented. VK_SUBOPTIMAL_KHR: presented,
+    // but the swapchain was recreated afterwards. VK_ERROR_OUT_OF_DATE_KHR:
+    // nothing was presented and the swapchain was recreated. Either way the
+    // new swapchain shows nothing until the next draw().
     VkResult draw();
     void rotateModel(float x, float y, float z);
     void updateMVP();
+    void setObjectCount(uint32_t num);
+    uint32_t getObjectCount();
+    TransformPath getTransformPath();
+    void recreateSwapchain();
+    void releaseSurface();
+    bool attachSurface(ANativeWindow *window);
+    void setSwapchainPolicy(SwapchainPolicy policy);
+    SwapchainPolicy getSwapchainPolicy();
+    bool getSwapchainPolicyStats(swapchain_policy_stats *stats);
+    void reportSwapchainPolicy();
+    uint32_t getFramesInFlight();
+    double measureFrameTime(uint32_t frameNum, double *fenceWait);
+    bool readPixels(std::vector<uint8_t> &rgba);
+    bool getFrameStats(FrameStatType type, frame_stat_summary *summary);
+    void reportFrameStats();
+    void getMemoryStats(gpu_memory_stats *stats);
+    void reportMemoryStats();
+    void getResourceTotals(resource_totals *totals);
+    void reportResources(const char *when);
 
     VkInstance          instance_;
     VkPhysicalDevice    gpuDevice_;
@@ -64,8 +167,9 @@ public:
 
     VkSurfaceKHR        surface_;
     VkQueue             queue_;
+    // Same as queue_ unless the device has a separate transfer family
+    VkQueue             transfer_queue_;
 
-    VkDescriptorSetLayout descLayout;
     VkPipelineLayout  pipelineLayout;
 
     uint32_t width;
@@ -73,7 +177,11 @@ public:
 
 private:
     bool initialized;
+    bool headless;
     android_app *androidAppCtx;
+    ANativeWindow *window_;
+    // Read once by init(), the mesh is uploaded and the file closed
+    const char *meshPath;
     //
     std::vector<layer_properties> instance_layer_properties;
     std::vector<const char *> instance_layer_names;
@@ -84,37 +192,59 @@ private:
     VkPhysicalDeviceProperties gpu_props;
     std::vector<VkQueueFamilyProperties> queue_props;
     uint32_t queue_count;
-    VkPhysicalDeviceMemoryProperties memory_properties;
+    // Every Vulkan object below the device is tracked in it
+    ResourceRegistry registry;
+    // Resource totals at the last releaseSurface(), liveCount is 0 before
+    resource_totals releasedTotals;
+    // Every device memory allocation goes through it
+    GpuAllocator allocator;
+    // Static geometry reaches DEVICE_LOCAL buffers through it
+    StagingUploader uploader;
+#ifdef __ANDROID__
     PFN_vkCreateAndroidSurfaceKHR fpCreateAndroidSurfaceKHR;
+#endif
     uint32_t graphics_queue_family_index;
+    uint32_t transfer_queue_family_index;
     VkFormat format;
     VkCommandPool cmd_pool;
     //VkCommandBuffer cmd; // Buffer for initialization commands
-    VkCommandBuffer *cmdBuffer;
     uint32_t swapchainImageCount;
     VkSwapchainKHR swap_chain;
+    SwapchainPolicy swapchainPolicy;
+    VkPresentModeKHR presentMode;
     std::vector<swap_chain_buffer> buffers;
     uint32_t current_buffer;
+    // Image holding the newest headless frame, UINT32_MAX before the first one
+    uint32_t lastRenderedBuffer;
 
     struct {
         VkFormat format;
 
         VkImage image;
-        VkDeviceMemory mem;
+        gpu_allocation alloc;
         VkImageView view;
     } depth;
 
-    glm::mat4 Projection;
-    glm::mat4 View;
-    glm::mat4 Model;
-    glm::mat4 Clip;
-    glm::mat4 MVP;
+    TransformState transforms;
+
+    // Teapots drawn per frame, laid out on a grid. Each one is a separate
+    // draw with its own transform.
+    TransformPath transformPath;
+    uint32_t objectCount;
+    // Dynamic offset of every object's transform in the current frame
+    std::vector<uint32_t> objectOffsets;
 
+    // Persistently mapped, one arena region per possible frame in flight.
+    // The single descriptor set covers one transform, each draw moves it
+    // to its own allocation with a dynamic offset.
     struct {
         VkBuffer buf;
-        VkDeviceMemory mem;
+        gpu_allocation alloc;
         VkDescriptorBufferInfo buffer_info;
+        uint8_t *mapped;
+        bool coherent;
     } uniform_data;
+    UniformArena uniformArena;
 
     std::vector<VkDescriptorSetLayout> desc_layout;
     VkRenderPass render_pass;
@@ -123,12 +253,21 @@ private:
 
     struct {
         VkBuffer buf;
-        VkDeviceMemory mem;
+        gpu_allocation alloc;
         VkDescriptorBufferInfo buffer_info;
     } vertex_buffer;
-    VkVertexInputBindingDescription vi_binding;
-    VkVertexInputAttributeDescription vi_attribs[2];
+    // Generated from the mesh vertex layout, every binding reads
+    // vertex_buffer starting at its entry of vertex_offsets
+    std::vector<VkVertexInputBindingDescription> vi_bindings;
+    std::vector<VkVertexInputAttributeDescription> vi_attribs;
+    std::vector<VkDeviceSize> vertex_offsets;
     VkBuffer indexBuf;
+    gpu_allocation indexAlloc;
+    VkIndexType indexType;
+    // Decodes quantized positions, folded into the model matrix
+    glm::mat4 meshDequantize;
+    // Specialization constant of the vertex shaders, NormalDecode
+    uint32_t normalDecode;
     size_t drawElementNum;
     size_t drawInstanceNum;
 
@@ -142,9 +281,18 @@ private:
     VkPipelineCache pipelineCache;
     VkPipeline pipeline;
 
-    VkFence drawFence;
-    VkSemaphore presentCompleteSemaphore;
-    VkPresentInfoKHR present;
+    uint32_t framesInFlight;
+    uint32_t currentFrame;
+    std::vector<frame_resources> frames;
+    // Fence of the frame that last submitted each swapchain image's command buffer
+    std::vector<VkFence> imagesInFlight;
+    double fenceWaitTime;
+    FrameStats frameStats;
+
+    // Frame pacing measured for the current swapchain policy
+    double lastFrameStart;
+    uint32_t policyFrames;
+    double policyIntervalSum;
 
     //
 
@@ -154,42 +302,50 @@ private:
     void init_device_extension_names();
     VkResult init_instance(char const *const app_short_name);
     VkResult init_enumerate_device(uint32_t gpu_count);
+    bool init_surface();
     bool init_swapchain_extension();
+    bool init_headless_queue();
+    VkFormat get_surface_format();
+    uint32_t find_transfer_queue_family();
     VkResult init_device();
     void init_command_pool();
-    void init_command_buffer();
-    void execute_begin_command_buffer();
     void init_device_queue();
     void init_swap_chain(VkImageUsageFlags usageFlags);
     void initSwapChainImages();
+    void init_offscreen_images();
+    VkFormat get_depth_format();
     bool init_depth_buffer();
     void init_uniform_buffer();
+    void updateProjection();
     void init_descriptor_and_pipeline_layouts(bool use_texture);
 
         //
-    void set_image_layout(uint32_t cmdIndex, VkImage image,
+    void set_image_layout(VkCommandBuffer cmd, VkImage image,
                           VkImageAspectFlags aspectMask,
                           VkImageLayout old_image_layout,
                           VkImageLayout new_image_layout);
-    bool memory_type_from_properties(uint32_t typeBits,
-                                     VkFlags requirements_mask,
-                                     uint32_t *typeIndex);
     void init_renderpass(bool include_depth, bool clear);
     void init_shaders();
     void init_framebuffers(bool include_depth);
-    void init_vertex_buffer(const void *vertexData,
-                            uint32_t dataSize, uint32_t dataStride,
-                            bool use_texture);
-
-    void initVertexBufferWithNormal(const float *vertexData,
-          uint32_t vertexDataSize, const float *normalData, uint32_t normalDataSiza);
-    void initIndexForVertex(const uint16_t *indexData, size_t indexDataSize);
+    void init_device_local_buffer(const char *name, VkBufferUsageFlags usage,
+                                  const void *data, VkDeviceSize size,
+                                  VkPipelineStageFlags dstStage,
+                                  VkAccessFlags dstAccess, VkBuffer *buf,
+                                  gpu_allocation *alloc);
+    void init_vertex_input(const vertex_layout *layout, size_t vertexCount);
+    bool initMesh(const char *path);
     void init_descriptor_pool(bool use_texture);
     void init_descriptor_set(bool use_texture);
     void init_pipeline_cache();
     void init_pipeline(VkBool32 include_depth, VkBool32 include_vi);
 
-    void preDraw();
+    void recordCommandBuffer(VkCommandBuffer cmd, uint32_t imageIndex);
+    void writeUniforms(uint32_t frameIndex);
+    VkResult drawHeadless();
+    void init_swap_chain_resources();
+    void destroy_swap_chain_resources();
+    void init_frame_resources();
+    void destroy_frame_resources();
 
 };
 
@@ -16,6 +16,7 @@
 
 #include <vector>
 #include <cassert>
+#include <time.h>
 #include <android/log.h>
 #include <android_native_app_glue.h>
 #include "vulkan_wrapper.h"
@@ -45,18 +46,50 @@ VulkanDevice *device = nullptr;
 // Android Native App pointer...
 android_app* androidAppCtx = nullptr;
 
+// How the MVP reaches the vertex shader, fixed for the lifetime of the device
+static const TransformPath kTransformPath = TRANSFORM_PATH_UNIFORM_BUFFER;
+
+// Input accumulated between two frames. Touch digitizers deliver several
+// move events per frame, only the latest state matters and it is applied
+// to the model once at the start of the next frame.
+static struct {
+    float dragX;
+    float dragY;
+    bool pending;
+} inputState;
+
+// Time the window became available, cleared once its first frame is submitted
+static double windowInitTime = 0.0;
+static bool resumed = false;
+
+static double getTimeMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
 // InitVulkan:
 //   Initialize Vulkan Context when android application window is created
 //   upon return, vulkan is ready to draw frames
-bool InitVulkan(android_app* app) {
+bool InitVulkan(android_app* app, ANativeWindow* window) {
     androidAppCtx = app;
+    windowInitTime = getTimeMs();
+
+    // Fast resume: the device and GPU resources survived the window loss,
+    // only the surface and swapchain have to be created again
+    if (device) {
+        resumed = true;
+        return device->attachSurface(window);
+    }
+    resumed = false;
 
     if (!InitVulkan()) {
         LOGW("Vulkan is unavailable, install vulkan and re-start");
         return false;
     }
 
-    device = new VulkanDevice(app);
+    device = new VulkanDevice(app, window, DEFAULT_FRAMES_IN_FLIGHT,
+                              kTransformPath);
 
   return true;
 }
@@ -72,20 +105,55 @@ bool IsVulkanReady(void) {
     }
 }
 
+// Window is gone but the application keeps running
+void VulkanReleaseSurface(void) {
+    if (device) {
+        device->releaseSurface();
+    }
+}
+
 void DeleteVulkan() {
     delete device;
+    device = nullptr;
 }
 
 // Draw one frame
-bool VulkanDrawFrame(void) {
-    //device->draw();
-    return true;
+VkResult VulkanDrawFrame(void) {
+    if (inputState.pending) {
+        float yrot = 360.0f / device->width * inputState.dragX;
+        device->rotateModel(0, yrot, 0);
+        inputState.pending = false;
+    }
+
+    VkResult res = device->draw();
+
+    // An out of date acquire rendered nothing, the first frame is still due
+    if (windowInitTime > 0.0 && res != VK_ERROR_OUT_OF_DATE_KHR) {
+        LOGI("time to first frame (%s): %.2f ms", resumed ? "resume" : "cold start",
+             getTimeMs() - windowInitTime);
+        windowInitTime = 0.0;
+    }
+    return res;
 }
 
 void VulkanOnDrag(float x, float y) {
-    if (device) {
-        float yrot = 360.0f / device->width * x;
-        device->rotateModel(0, yrot, 0);
+    // Drag distances are measured from the touch down position, so the
+    // newest event supersedes the ones received earlier in this frame
+    inputState.dragX = x;
+    inputState.dragY = y;
+    inputState.pending = true;
+}
+
+void VulkanOnWindowResized(void) {
+    if (device && device->isReady()) {
+        device->recreateSwapchain();
     }
 }
 
+void VulkanSetSwapchainPolicy(SwapchainPolicy policy) {
+    if (device) {
+        // Log what the previous policy achieved before switching
+        device->reportSwapchainPolicy();
+        device->setSwapchainPolicy(policy);
+    }
+}
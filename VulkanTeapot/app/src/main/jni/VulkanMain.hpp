@@ -17,9 +17,17 @@
 #ifndef __VULKANMAIN_HPP__
 #define __VULKANMAIN_HPP__
 
+#include "VulkanDevice.h"
+
 // Initialize vulkan device context
 // after return, vulkan is ready to draw
-bool InitVulkan(android_app* app);
+// window is the native window to render to, it has to stay valid until
+// VulkanReleaseSurface() returns
+bool InitVulkan(android_app* app, ANativeWindow* window);
+
+// release the window surface and swapchain when the window goes away,
+// the device and GPU resources are kept for the next InitVulkan()
+void VulkanReleaseSurface(void);
 
 // delete vulkan device context when application goes away
 void DeleteVulkan(void);
@@ -27,11 +35,17 @@ void DeleteVulkan(void);
 // Check if vulkan is ready to draw
 bool IsVulkanReady(void);
 
-// Ask Vulkan to Render a frame
-bool VulkanDrawFrame(void);
+// Ask Vulkan to Render a frame, returns the result of VulkanDevice::draw()
+VkResult VulkanDrawFrame(void);
 
 void VulkanOnDrag(float x, float y);
 
+// Rebuild the swapchain after the window size or orientation changed
+void VulkanOnWindowResized(void);
+
+// Switch the present mode / swapchain depth trade-off at runtime
+void VulkanSetSwapchainPolicy(SwapchainPolicy policy);
+
 #endif // __VULKANMAIN_HPP__
 
 
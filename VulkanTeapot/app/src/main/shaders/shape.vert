@@ -22,13 +22,29 @@ layout (std140, binding = 0) uniform bufferVals {
 } myBufferVals;
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 inNormal;
+// How the mesh stores normals: 0 float, 1 unorm 10:10:10:2, 2 octahedral
+layout (constant_id = 0) const int normalDecode = 0;
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec4 position;
 out gl_PerVertex {
     vec4 gl_Position;
 };
+vec3 decodeNormal(vec3 n) {
+   if (normalDecode == 1) {
+      return n * 2.0 - 1.0;
+   }
+   if (normalDecode == 2) {
+      vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+      if (v.z < 0.0) {
+         vec2 s = vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+         v.xy = (1.0 - abs(v.yx)) * s;
+      }
+      return v;
+   }
+   return n;
+}
 void main() {
-   outNormal = inNormal;
+   outNormal = decodeNormal(inNormal);
    gl_Position = myBufferVals.mvp * vec4(pos, 1);
    position = gl_Position;
 }
\ No newline at end of file
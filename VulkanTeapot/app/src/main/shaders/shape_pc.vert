@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#version 400
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+// Same as shape.vert, the transform comes in push constants instead of a
+// uniform buffer
+layout (push_constant) uniform pushConstants {
+    mat4 mvp;
+} myPushConstants;
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec3 inNormal;
+// How the mesh stores normals: 0 float, 1 unorm 10:10:10:2, 2 octahedral
+layout (constant_id = 0) const int normalDecode = 0;
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec4 position;
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+vec3 decodeNormal(vec3 n) {
+   if (normalDecode == 1) {
+      return n * 2.0 - 1.0;
+   }
+   if (normalDecode == 2) {
+      vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+      if (v.z < 0.0) {
+         vec2 s = vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+         v.xy = (1.0 - abs(v.yx)) * s;
+      }
+      return v;
+   }
+   return n;
+}
+void main() {
+   outNormal = decodeNormal(inNormal);
+   gl_Position = myPushConstants.mvp * vec4(pos, 1);
+   position = gl_Position;
+}
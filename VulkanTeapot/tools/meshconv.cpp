@@ -0,0 +1,669 @@
+/*
+ * Copyright (c) 2016 Kenichi Takahashi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host tool converting geometry into the binary mesh files the renderer
+// maps at load time, see MeshFile.h for the layout. Reads Wavefront OBJ
+// files, or the built-in teapot:
+//
+//   meshconv teapot ../app/src/main/assets/teapot.mesh
+//   meshconv --normal unorm10 model.obj model.mesh
+//
+// OBJ faces are triangulated as fans, vertices are shared per distinct
+// position/texcoord/normal triple. Files without normals get smooth ones.
+//
+// Positions and normals are written by default, the ones the shaders read.
+// --attributes picks others the source has, the teapot also carries
+// texcoords, tangents and binormals. Attributes are quantized by default,
+// --position, --normal, --texcoord, --tangent and --binormal select their
+// formats. The report gives the vertex fetch saved and the worst error
+// each format introduced.
+//
+// The encoded vertices are welded where bit identical, degenerate
+// triangles dropped, triangles reordered for the post-transform vertex
+// cache and for overdraw, and vertices renumbered in fetch order.
+// --no-optimize writes the mesh as authored and leaves all of it to the
+// renderer at load time.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "MeshFile.h"
+#include "MeshOptimizer.h"
+#include "VertexPacker.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/packing.hpp"
+#include "teapot.inl"
+
+// Positions, normals, tangents and binormals, 3 floats each per vertex,
+// texcoords 2 floats per vertex, empty when the source lacks them
+struct mesh {
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<float> tangents;
+    std::vector<float> binormals;
+    std::vector<uint32_t> indices;
+};
+
+// Attributes to write as a mask of semantic bits, the storage chosen for
+// each semantic, and whether to reorder triangles
+struct formats {
+    uint32_t attributes;
+    uint32_t format[MESH_ATTRIBUTE_SEMANTIC_NUM];
+    bool optimize;
+};
+
+static const char *const kSemanticNames[MESH_ATTRIBUTE_SEMANTIC_NUM] = {
+        "position", "normal", "texcoord", "tangent", "binormal" };
+
+static void loadTeapot(mesh &m) {
+    m.positions.assign(teapotPositions, teapotPositions +
+                       sizeof(teapotPositions) / sizeof(float));
+    m.normals.assign(teapotNormals, teapotNormals +
+                     sizeof(teapotNormals) / sizeof(float));
+    m.tangents.assign(teapotTangents, teapotTangents +
+                      sizeof(teapotTangents) / sizeof(float));
+    m.binormals.assign(teapotBinormals, teapotBinormals +
+                       sizeof(teapotBinormals) / sizeof(float));
+    // Stored as u, v, 0
+    size_t vertexCount = sizeof(teapotTexCoords) / sizeof(float) / 3;
+    for (size_t i = 0; i < vertexCount; i++) {
+        m.texcoords.push_back(teapotTexCoords[i * 3]);
+        m.texcoords.push_back(teapotTexCoords[i * 3 + 1]);
+    }
+    m.indices.assign(teapotIndices, teapotIndices +
+                     sizeof(teapotIndices) / sizeof(uint16_t));
+}
+
+static const std::vector<float> &getSource(const mesh &m, uint32_t semantic) {
+    switch (semantic) {
+        case MESH_ATTRIBUTE_NORMAL:
+            return m.normals;
+        case MESH_ATTRIBUTE_TEXCOORD:
+            return m.texcoords;
+        case MESH_ATTRIBUTE_TANGENT:
+            return m.tangents;
+        case MESH_ATTRIBUTE_BINORMAL:
+            return m.binormals;
+        default:
+            return m.positions;
+    }
+}
+
+// OBJ indices are 1-based, negative ones count back from the end
+static int resolveIndex(long index, size_t count) {
+    if (index > 0 && (size_t)index <= count) {
+        return (int)index - 1;
+    }
+    if (index < 0 && (size_t)-index <= count) {
+        return (int)(count + index);
+    }
+    return -1;
+}
+
+// Area weighted normals of the triangles around each vertex
+static void computeNormals(mesh &m) {
+    m.normals.assign(m.positions.size(), 0.0f);
+    for (size_t i = 0; i + 2 < m.indices.size(); i += 3) {
+        const float *p0 = &m.positions[m.indices[i] * 3];
+        const float *p1 = &m.positions[m.indices[i + 1] * 3];
+        const float *p2 = &m.positions[m.indices[i + 2] * 3];
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float n[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                       e1[2] * e2[0] - e1[0] * e2[2],
+                       e1[0] * e2[1] - e1[1] * e2[0] };
+        for (int v = 0; v < 3; v++) {
+            float *dst = &m.normals[m.indices[i + v] * 3];
+            dst[0] += n[0];
+            dst[1] += n[1];
+            dst[2] += n[2];
+        }
+    }
+    for (size_t i = 0; i < m.normals.size(); i += 3) {
+        float *n = &m.normals[i];
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length > 0.0f) {
+            n[0] /= length;
+            n[1] /= length;
+            n[2] /= length;
+        }
+    }
+}
+
+static bool loadObj(const char *path, mesh &m) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    // Position, texcoord and normal indices to the shared vertex
+    typedef std::pair<int, std::pair<int, int> > vertex_key;
+    std::map<vertex_key, uint32_t> vertices;
+    bool hasNormals = true;
+    bool hasTexcoords = true;
+    char line[1024];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        float x, y, z;
+        if (!strncmp(line, "v ", 2)) {
+            if (sscanf(line + 2, "%f %f %f", &x, &y, &z) != 3) {
+                fprintf(stderr, "%s:%d: bad vertex\n", path, lineNumber);
+                fclose(file);
+                return false;
+            }
+            positions.push_back(x);
+            positions.push_back(y);
+            positions.push_back(z);
+        } else if (!strncmp(line, "vn ", 3)) {
+            if (sscanf(line + 3, "%f %f %f", &x, &y, &z) != 3) {
+                fprintf(stderr, "%s:%d: bad normal\n", path, lineNumber);
+                fclose(file);
+                return false;
+            }
+            normals.push_back(x);
+            normals.push_back(y);
+            normals.push_back(z);
+        } else if (!strncmp(line, "vt ", 3)) {
+            if (sscanf(line + 3, "%f %f", &x, &y) != 2) {
+                fprintf(stderr, "%s:%d: bad texcoord\n", path, lineNumber);
+                fclose(file);
+                return false;
+            }
+            texcoords.push_back(x);
+            texcoords.push_back(y);
+        } else if (!strncmp(line, "f ", 2)) {
+            // v, v/vt, v//vn or v/vt/vn
+            std::vector<uint32_t> face;
+            char *cursor = line + 2;
+            while (true) {
+                char *end;
+                long p = strtol(cursor, &end, 10);
+                if (end == cursor) {
+                    break;
+                }
+                long t = 0;
+                long n = 0;
+                cursor = end;
+                if (*cursor == '/') {
+                    cursor++;
+                    t = strtol(cursor, &end, 10);
+                    cursor = end;
+                    if (*cursor == '/') {
+                        cursor++;
+                        n = strtol(cursor, &end, 10);
+                        cursor = end;
+                    }
+                }
+                int position = resolveIndex(p, positions.size() / 3);
+                int texcoord = t ? resolveIndex(t, texcoords.size() / 2) : -1;
+                int normal = n ? resolveIndex(n, normals.size() / 3) : -1;
+                if (position < 0 || (t && texcoord < 0) ||
+                    (n && normal < 0)) {
+                    fprintf(stderr, "%s:%d: bad face\n", path, lineNumber);
+                    fclose(file);
+                    return false;
+                }
+                hasNormals = hasNormals && normal >= 0;
+                hasTexcoords = hasTexcoords && texcoord >= 0;
+                // Without normals vertices are shared per position, the
+                // smooth normals are computed over all their triangles
+                vertex_key key(position, std::make_pair(texcoord, normal));
+                std::map<vertex_key, uint32_t>::iterator it =
+                        vertices.find(key);
+                if (it == vertices.end()) {
+                    uint32_t index = (uint32_t)(m.positions.size() / 3);
+                    it = vertices.insert(std::make_pair(key, index)).first;
+                    m.positions.insert(m.positions.end(),
+                                       &positions[position * 3],
+                                       &positions[position * 3] + 3);
+                    if (normal >= 0) {
+                        m.normals.insert(m.normals.end(),
+                                         &normals[normal * 3],
+                                         &normals[normal * 3] + 3);
+                    } else {
+                        m.normals.insert(m.normals.end(), 3, 0.0f);
+                    }
+                    if (texcoord >= 0) {
+                        m.texcoords.insert(m.texcoords.end(),
+                                           &texcoords[texcoord * 2],
+                                           &texcoords[texcoord * 2] + 2);
+                    } else {
+                        m.texcoords.insert(m.texcoords.end(), 2, 0.0f);
+                    }
+                }
+                face.push_back(it->second);
+            }
+            for (size_t i = 2; i < face.size(); i++) {
+                m.indices.push_back(face[0]);
+                m.indices.push_back(face[i - 1]);
+                m.indices.push_back(face[i]);
+            }
+        }
+    }
+    fclose(file);
+    if (m.indices.empty()) {
+        fprintf(stderr, "%s has no faces\n", path);
+        return false;
+    }
+    if (!hasNormals) {
+        printf("%s lacks normals, computing smooth ones\n", path);
+        computeNormals(m);
+    }
+    if (!hasTexcoords) {
+        m.texcoords.clear();
+    }
+    return true;
+}
+
+static void pad(FILE *file, long alignment) {
+    static const uint8_t zeros[MESH_FILE_ALIGNMENT] = {};
+    long position = ftell(file);
+    long padding = (alignment - position % alignment) % alignment;
+    fwrite(zeros, 1, padding, file);
+}
+
+static uint64_t alignUp(uint64_t value) {
+    return (value + MESH_FILE_ALIGNMENT - 1) &
+           ~(uint64_t)(MESH_FILE_ALIGNMENT - 1);
+}
+
+static float fromSnorm16(int16_t value) {
+    return fmaxf(value / 32767.0f, -1.0f);
+}
+
+static float signNotZero(float value) {
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Inverse of the octahedral projection packVertices() does, the same as
+// decodeNormal() in the vertex shaders
+static void decodeOctahedral(const int16_t *in, float *n) {
+    n[0] = fromSnorm16(in[0]);
+    n[1] = fromSnorm16(in[1]);
+    n[2] = 1.0f - fabsf(n[0]) - fabsf(n[1]);
+    if (n[2] < 0.0f) {
+        float unfolded = (1.0f - fabsf(n[1])) * signNotZero(n[0]);
+        n[1] = (1.0f - fabsf(n[0])) * signNotZero(n[1]);
+        n[0] = unfolded;
+    }
+}
+
+// Angle between two directions in degrees, neither has to be normalized
+static float angleBetween(const float *a, const float *b) {
+    float ab = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    float aa = a[0] * a[0] + a[1] * a[1] + a[2] * a[2];
+    float bb = b[0] * b[0] + b[1] * b[1] + b[2] * b[2];
+    if (aa == 0.0f || bb == 0.0f) {
+        return 0.0f;
+    }
+    float cosine = fminf(fmaxf(ab / sqrtf(aa * bb), -1.0f), 1.0f);
+    return acosf(cosine) * 180.0f / (float)M_PI;
+}
+
+// Reads one packed attribute back as the shaders see it, positions in
+// object units
+static void decodeAttribute(const uint8_t *src, uint32_t format,
+                            const mesh_file_header &header, float *out) {
+    switch (format) {
+        case MESH_FORMAT_SNORM16X4: {
+            int16_t q[4];
+            memcpy(q, src, sizeof(q));
+            for (int c = 0; c < 3; c++) {
+                out[c] = fromSnorm16(q[c]) * header.positionScale[c] +
+                         header.positionBias[c];
+            }
+            break;
+        }
+        case MESH_FORMAT_UNORM10X3: {
+            uint32_t packed;
+            memcpy(&packed, src, sizeof(packed));
+            for (int c = 0; c < 3; c++) {
+                out[c] = ((packed >> (10 * c)) & 1023) / 1023.0f * 2.0f - 1.0f;
+            }
+            break;
+        }
+        case MESH_FORMAT_OCT_SNORM16X2: {
+            int16_t q[2];
+            memcpy(q, src, sizeof(q));
+            decodeOctahedral(q, out);
+            break;
+        }
+        case MESH_FORMAT_FLOAT16X2: {
+            uint32_t packed;
+            memcpy(&packed, src, sizeof(packed));
+            glm::vec2 texcoord = glm::unpackHalf2x16(packed);
+            out[0] = texcoord.x;
+            out[1] = texcoord.y;
+            break;
+        }
+        case MESH_FORMAT_FLOAT32X2:
+            memcpy(out, src, 2 * sizeof(float));
+            break;
+        default:
+            memcpy(out, src, 3 * sizeof(float));
+            break;
+    }
+}
+
+// Worst error an attribute picked up in quantization, in object units for
+// positions, texcoord units, and degrees for the directions
+static float measureError(const mesh &m, const uint8_t *vertices,
+                          uint32_t vertexCount, uint32_t stride,
+                          const mesh_file_attribute &attribute,
+                          const mesh_file_header &header) {
+    const std::vector<float> &source = getSource(m, attribute.semantic);
+    uint32_t components = (uint32_t)(source.size() / vertexCount);
+    float error = 0.0f;
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        const float *expected = &source[v * components];
+        float decoded[3] = {};
+        decodeAttribute(vertices + v * stride + attribute.offset,
+                        attribute.format, header, decoded);
+        if (attribute.semantic == MESH_ATTRIBUTE_POSITION ||
+            attribute.semantic == MESH_ATTRIBUTE_TEXCOORD) {
+            for (uint32_t c = 0; c < components; c++) {
+                error = fmaxf(error, fabsf(decoded[c] - expected[c]));
+            }
+        } else {
+            error = fmaxf(error, angleBetween(expected, decoded));
+        }
+    }
+    return error;
+}
+
+static size_t indexSizeFor(size_t vertexCount) {
+    return vertexCount <= 0x10000 ? 2 : 4;
+}
+
+static bool writeMesh(const char *path, const mesh &m, const formats &f) {
+    uint32_t vertexCount = (uint32_t)(m.positions.size() / 3);
+
+    // Interleaved in semantic order
+    vertex_layout layout;
+    initVertexLayout(&layout);
+    for (uint32_t semantic = 0; semantic < MESH_ATTRIBUTE_SEMANTIC_NUM;
+         semantic++) {
+        if (f.attributes & 1u << semantic) {
+            addVertexAttribute(&layout, semantic, f.format[semantic], 0);
+        }
+    }
+    uint32_t attributeCount = layout.attributeCount;
+    uint32_t stride = layout.strides[0];
+    mesh_file_attribute attributes[MESH_FILE_MAX_ATTRIBUTES] = {};
+    for (uint32_t i = 0; i < attributeCount; i++) {
+        attributes[i].semantic = layout.attributes[i].semantic;
+        attributes[i].format = layout.attributes[i].format;
+        attributes[i].offset = layout.attributes[i].offset;
+    }
+
+    mesh_file_header header = {};
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.attributeCount = attributeCount;
+    header.vertexStride = stride;
+    header.flags = f.optimize ? MESH_FILE_FLAG_TRIANGLES_OPTIMIZED |
+                                MESH_FILE_FLAG_VERTICES_COMPACTED : 0;
+    for (int c = 0; c < 3; c++) {
+        header.boundsMin[c] = HUGE_VALF;
+        header.boundsMax[c] = -HUGE_VALF;
+    }
+    for (size_t i = 0; i < m.positions.size(); i++) {
+        int c = i % 3;
+        header.boundsMin[c] = fminf(header.boundsMin[c], m.positions[i]);
+        header.boundsMax[c] = fmaxf(header.boundsMax[c], m.positions[i]);
+    }
+    // Quantized positions span the bounds, a flat axis keeps scale 1 so
+    // decoding never divides by zero
+    for (int c = 0; c < 3; c++) {
+        float extent = (header.boundsMax[c] - header.boundsMin[c]) * 0.5f;
+        bool quantized =
+                f.format[MESH_ATTRIBUTE_POSITION] == MESH_FORMAT_SNORM16X4;
+        header.positionScale[c] = quantized && extent > 0.0f ? extent : 1.0f;
+        header.positionBias[c] = quantized ?
+                (header.boundsMax[c] + header.boundsMin[c]) * 0.5f : 0.0f;
+        layout.positionScale[c] = header.positionScale[c];
+        layout.positionBias[c] = header.positionBias[c];
+    }
+
+    std::vector<uint8_t> vertices((size_t)vertexCount * stride);
+    vertex_stream streams[MESH_ATTRIBUTE_SEMANTIC_NUM] = {};
+    for (uint32_t semantic = 0; semantic < MESH_ATTRIBUTE_SEMANTIC_NUM;
+         semantic++) {
+        const std::vector<float> &source = getSource(m, semantic);
+        streams[semantic].data = source.data();
+        streams[semantic].components = (uint32_t)(source.size() / vertexCount);
+    }
+    void *dst = vertices.data();
+    packVertices(&layout, streams, vertexCount, &dst);
+    float errors[MESH_FILE_MAX_ATTRIBUTES];
+    for (uint32_t i = 0; i < attributeCount; i++) {
+        errors[i] = measureError(m, vertices.data(), vertexCount, stride,
+                                 attributes[i], header);
+    }
+
+    // Welding compares the encoded bytes, quantization can make more
+    // vertices identical than the source had
+    std::vector<uint32_t> indices(m.indices);
+    size_t indexCount = indices.size();
+    size_t bytesBefore = vertices.size() +
+                         indexCount * indexSizeFor(vertexCount);
+    if (f.optimize) {
+        std::vector<float> positions(m.positions);
+        size_t count = vertexCount;
+        mesh_optimize_stats stats;
+        optimizeMesh(vertices.data(), stride, &count, indices.data(),
+                     &indexCount, positions.data(), true, &stats);
+        vertexCount = (uint32_t)count;
+        vertices.resize(count * stride);
+        indices.resize(indexCount);
+        printf("vertices %zu -> %zu, triangles %zu -> %zu, "
+               "ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%u entry FIFO)\n",
+               stats.vertexCountBefore, stats.vertexCountAfter,
+               stats.triangleCountBefore, stats.triangleCountAfter,
+               stats.cacheBefore.acmr, stats.cacheAfter.acmr,
+               stats.cacheBefore.atvr, stats.cacheAfter.atvr,
+               VERTEX_CACHE_REPORT_SIZE);
+    }
+    header.vertexCount = vertexCount;
+    header.indexCount = (uint32_t)indexCount;
+    header.indexSize = (uint32_t)indexSizeFor(vertexCount);
+    header.vertexOffset = alignUp(sizeof(header) +
+                                  attributeCount * sizeof(attributes[0]));
+    header.indexOffset = alignUp(header.vertexOffset + vertices.size());
+    size_t bytesAfter = vertices.size() + indexCount * header.indexSize;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Cannot create %s\n", path);
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(attributes, sizeof(attributes[0]), attributeCount, file);
+    pad(file, MESH_FILE_ALIGNMENT);
+    fwrite(vertices.data(), 1, vertices.size(), file);
+    pad(file, MESH_FILE_ALIGNMENT);
+    if (header.indexSize == 2) {
+        std::vector<uint16_t> indices16(indices.begin(), indices.end());
+        fwrite(indices16.data(), sizeof(uint16_t), indices16.size(), file);
+    } else {
+        fwrite(indices.data(), sizeof(uint32_t), indices.size(), file);
+    }
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return false;
+    }
+    printf("%s: %u vertices, %u indices of %u bytes, bounds "
+           "(%g %g %g) - (%g %g %g)\n", path, vertexCount, header.indexCount,
+           header.indexSize, header.boundsMin[0], header.boundsMin[1],
+           header.boundsMin[2], header.boundsMax[0], header.boundsMax[1],
+           header.boundsMax[2]);
+    uint32_t floatStride = getMeshFloatStride(attributes, attributeCount);
+    printf("vertex stride %u bytes, %u as floats: %zu of %zu vertex bytes, "
+           "%.0f%% saved\n", stride, floatStride, vertices.size(),
+           (size_t)vertexCount * floatStride,
+           100.0 * (1.0 - (double)stride / floatStride));
+    printf("max error:");
+    for (uint32_t i = 0; i < attributeCount; i++) {
+        uint32_t semantic = attributes[i].semantic;
+        bool direction = semantic != MESH_ATTRIBUTE_POSITION &&
+                         semantic != MESH_ATTRIBUTE_TEXCOORD;
+        printf(direction ? "%s %s %.3f degrees" : "%s %s %g",
+               i ? "," : "", kSemanticNames[semantic], errors[i]);
+    }
+    printf("\n");
+    printf("vertex and index bytes %zu -> %zu\n", bytesBefore, bytesAfter);
+    return true;
+}
+
+// Comma separated semantic names into a mask of semantic bits
+static bool parseAttributes(const char *list, uint32_t *attributes) {
+    *attributes = 0;
+    const char *name = list;
+    while (true) {
+        size_t length = strcspn(name, ",");
+        uint32_t semantic = 0;
+        while (semantic < MESH_ATTRIBUTE_SEMANTIC_NUM &&
+               (strlen(kSemanticNames[semantic]) != length ||
+                strncmp(name, kSemanticNames[semantic], length))) {
+            semantic++;
+        }
+        if (semantic == MESH_ATTRIBUTE_SEMANTIC_NUM) {
+            return false;
+        }
+        *attributes |= 1u << semantic;
+        if (!name[length]) {
+            break;
+        }
+        name += length + 1;
+    }
+    // Positions drive the bounds and the optimizer
+    return (*attributes & 1u << MESH_ATTRIBUTE_POSITION) != 0;
+}
+
+// Looks name up in a table of option values, names and values are parallel
+static bool parseFormat(const char *name, const char *const *names,
+                        const uint32_t *values, uint32_t count,
+                        uint32_t *format) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (!strcmp(name, names[i])) {
+            *format = values[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [--attributes position,normal,texcoord,tangent,"
+            "binormal]\n"
+            "       [--position float|snorm16] "
+            "[--normal float|unorm10|oct16]\n"
+            "       [--texcoord float|half] [--tangent float|unorm10|oct16]\n"
+            "       [--binormal float|unorm10|oct16] [--no-optimize] "
+            "teapot|INPUT.obj OUTPUT.mesh\n", program);
+}
+
+int main(int argc, char **argv) {
+    static const char *const positionNames[] = { "float", "snorm16" };
+    static const uint32_t positionFormats[] = {
+            MESH_FORMAT_FLOAT32X3, MESH_FORMAT_SNORM16X4 };
+    static const char *const normalNames[] = { "float", "unorm10", "oct16" };
+    static const uint32_t normalFormats[] = {
+            MESH_FORMAT_FLOAT32X3, MESH_FORMAT_UNORM10X3,
+            MESH_FORMAT_OCT_SNORM16X2 };
+    static const char *const texcoordNames[] = { "float", "half" };
+    static const uint32_t texcoordFormats[] = {
+            MESH_FORMAT_FLOAT32X2, MESH_FORMAT_FLOAT16X2 };
+
+    formats f;
+    f.attributes = 1u << MESH_ATTRIBUTE_POSITION | 1u << MESH_ATTRIBUTE_NORMAL;
+    f.format[MESH_ATTRIBUTE_POSITION] = MESH_FORMAT_SNORM16X4;
+    f.format[MESH_ATTRIBUTE_NORMAL] = MESH_FORMAT_OCT_SNORM16X2;
+    f.format[MESH_ATTRIBUTE_TEXCOORD] = MESH_FORMAT_FLOAT16X2;
+    f.format[MESH_ATTRIBUTE_TANGENT] = MESH_FORMAT_OCT_SNORM16X2;
+    f.format[MESH_ATTRIBUTE_BINORMAL] = MESH_FORMAT_OCT_SNORM16X2;
+    f.optimize = true;
+    int arg = 1;
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++) {
+        if (!strcmp(argv[arg], "--no-optimize")) {
+            f.optimize = false;
+            continue;
+        }
+        if (arg + 1 == argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++arg];
+        bool ok;
+        const char *option = argv[arg - 1];
+        if (!strcmp(option, "--attributes")) {
+            ok = parseAttributes(value, &f.attributes);
+        } else if (!strcmp(option, "--position")) {
+            ok = parseFormat(value, positionNames, positionFormats, 2,
+                             &f.format[MESH_ATTRIBUTE_POSITION]);
+        } else if (!strcmp(option, "--normal")) {
+            ok = parseFormat(value, normalNames, normalFormats, 3,
+                             &f.format[MESH_ATTRIBUTE_NORMAL]);
+        } else if (!strcmp(option, "--texcoord")) {
+            ok = parseFormat(value, texcoordNames, texcoordFormats, 2,
+                             &f.format[MESH_ATTRIBUTE_TEXCOORD]);
+        } else if (!strcmp(option, "--tangent")) {
+            ok = parseFormat(value, normalNames, normalFormats, 3,
+                             &f.format[MESH_ATTRIBUTE_TANGENT]);
+        } else if (!strcmp(option, "--binormal")) {
+            ok = parseFormat(value, normalNames, normalFormats, 3,
+                             &f.format[MESH_ATTRIBUTE_BINORMAL]);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - arg != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    mesh m;
+    if (!strcmp(argv[arg], "teapot")) {
+        loadTeapot(m);
+    } else if (!loadObj(argv[arg], m)) {
+        return 1;
+    }
+    for (uint32_t semantic = 0; semantic < MESH_ATTRIBUTE_SEMANTIC_NUM;
+         semantic++) {
+        if (f.attributes & 1u << semantic && getSource(m, semantic).empty()) {
+            fprintf(stderr, "%s has no %ss\n", argv[arg],
+                    kSemanticNames[semantic]);
+            return 1;
+        }
+    }
+    return writeMesh(argv[arg + 1], m, f) ? 0 : 1;
+}